@@ -0,0 +1,253 @@
+/*** Render benchmark ***/
+#include <random>
+#include <map>
+
+#include "viewer.hh"
+
+/* Times the render functions on a synthetic iNES image, without a window.
+ *
+ * The first half of PRG is random bytes and the second half printable text,
+ * and CHR is random tiles, so that the hex, text and CHR pages of the dump
+ * can each be timed separately. The same code is used as in the viewer.
+ *
+ * Usage: viewerbench [-prg kB] [-chr kB] [-time seconds] [-json file] [-compare file]
+ * -json saves the results; -compare prints the change against a saved run.
+ */
+
+static double MinSeconds = 0.25;
+
+// Calls f() repeatedly for at least MinSeconds. Returns the seconds per call.
+template<typename F>
+static double Measure(F&& f)
+{
+    f(); // Warm up
+    unsigned long calls = 0;
+    auto begin = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{0};
+    do {
+        f();
+        ++calls;
+        elapsed = std::chrono::steady_clock::now() - begin;
+    } while(elapsed.count() < MinSeconds);
+    return elapsed.count() / calls;
+}
+
+static const struct Unit
+{
+    const char* label;
+    const char* key;
+    bool        higher_is_better;
+} NsPerScanline { "ns/scanline", "ns_per_scanline", false },
+  NsPerGlyph    { "ns/glyph",    "ns_per_glyph",    false },
+  MsPerFrame    { "ms/frame",    "ms_per_frame",    false },
+  MBperSec      { "MB/s",        "mb_per_s",        true  };
+
+struct Result
+{
+    std::string name;
+    double      value;
+    const Unit* unit;
+
+    std::string Key() const { return name + "." + unit->key; }
+};
+
+static std::vector<unsigned char> MakeImage(unsigned n_rom16k, unsigned n_vrom8k)
+{
+    std::vector<unsigned char> rom(16 + n_rom16k*ROMpageSize + n_vrom8k*VROMpageSize, 0);
+    rom[0] = 'N'; rom[1] = 'E'; rom[2] = 'S'; rom[3] = 0x1A;
+    rom[4] = n_rom16k;
+    rom[5] = n_vrom8k;
+
+    static const char text[] =
+        "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG. "
+        "the quick brown fox jumps over the lazy dog 0123456789\n";
+
+    std::mt19937 rnd(1);
+    unsigned char* prg = &rom[16];
+    unsigned char* chr = prg + n_rom16k*ROMpageSize;
+    std::size_t half = n_rom16k*ROMpageSize / 2;
+    for(std::size_t p=0; p<half; ++p)                  prg[p] = rnd();
+    for(std::size_t p=half; p<2*half; ++p)             prg[p] = text[rnd() % (sizeof(text)-1)];
+    for(std::size_t p=0; p<n_vrom8k*VROMpageSize; ++p) chr[p] = rnd();
+    return rom;
+}
+
+static bool SaveJSON(const char* filename, const std::vector<Result>& results,
+                     unsigned prg_kb, unsigned chr_kb, unsigned threads)
+{
+    std::FILE* fp = std::fopen(filename, "w");
+    if(!fp) return false;
+    std::fprintf(fp, "{\n  \"prg_kb\": %u,\n  \"chr_kb\": %u,\n  \"threads\": %u,\n  \"crc32\": \"%s\",\n  \"results\": {\n",
+        prg_kb, chr_kb, threads, crc32_engine_name());
+    for(std::size_t n=0; n<results.size(); ++n)
+        std::fprintf(fp, "    \"%s\": %.3f%s\n",
+            results[n].Key().c_str(), results[n].value, n+1 < results.size() ? "," : "");
+    std::fprintf(fp, "  }\n}\n");
+    return std::fclose(fp) == 0;
+}
+
+// Reads back the results from a file written by SaveJSON().
+static bool LoadJSON(const char* filename, std::map<std::string,double>& values)
+{
+    std::FILE* fp = std::fopen(filename, "r");
+    if(!fp) return false;
+    char line[256], key[128];
+    double value;
+    while(std::fgets(line, sizeof(line), fp))
+        if(std::sscanf(line, " \"%127[^\"]\": %lf", key, &value) == 2)
+            values[key] = value;
+    std::fclose(fp);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned prg_kb = 256, chr_kb = 128;
+    const char* json = nullptr, *compare = nullptr;
+    for(int a=1; a<argc; ++a)
+    {
+        bool arg = a+1 < argc;
+        if(arg && !std::strcmp(argv[a], "-prg"))          prg_kb     = std::atoi(argv[++a]);
+        else if(arg && !std::strcmp(argv[a], "-chr"))     chr_kb     = std::atoi(argv[++a]);
+        else if(arg && !std::strcmp(argv[a], "-time"))    MinSeconds = std::atof(argv[++a]);
+        else if(arg && !std::strcmp(argv[a], "-json"))    json       = argv[++a];
+        else if(arg && !std::strcmp(argv[a], "-compare")) compare    = argv[++a];
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [-prg kB] [-chr kB] [-time seconds] [-json file] [-compare file]\n", argv[0]);
+            return 1;
+        }
+    }
+    // The iNES header counts the pages in a byte.
+    unsigned n_rom16k = std::min(std::max(prg_kb / 16, 1u), 255u);
+    unsigned n_vrom8k = std::min(std::max(chr_kb / 8,  1u), 255u);
+    prg_kb = n_rom16k * 16;
+    chr_kb = n_vrom8k * 8;
+
+    ROMviewer viewer( ROMimage(MakeImage(n_rom16k, n_vrom8k)) );
+    viewer.MakeDirty();
+    const RenderState rs = viewer.CaptureState();
+
+    const FileOffset hex_begin  = FirstLineLength;
+    const FileOffset text_begin = hex_begin + n_rom16k*ROMpageSize/2;
+    const FileOffset chr_begin  = hex_begin + n_rom16k*ROMpageSize;
+    const struct { const char* name; FileOffset begin; } pages[] =
+        { { "hex", hex_begin }, { "text", text_begin }, { "chr", chr_begin } };
+
+    // Bytes of the image that one scanline of the dump shows.
+    const double   BytesPerScanline = double(CharsPerLine) / FontHeight;
+    const unsigned Scanlines        = 64 * FontHeight;
+    Pixel* scanline = &viewer.framebuffer[0];
+
+    std::vector<Result> results;
+    // Times f(offset, pixel row) over Scanlines scanlines of the dump, starting at "begin".
+    auto PerScanline = [&](const char* name, FileOffset begin, auto&& f)
+    {
+        double secs = Measure([&]
+        {
+            for(unsigned y=0; y<Scanlines; ++y)
+                f(begin + (y / FontHeight) * CharsPerLine, y % FontHeight);
+        });
+        results.push_back({ name, secs / Scanlines * 1e9, &NsPerScanline });
+    };
+
+    // The individual panes
+    PerScanline("left", hex_begin, [&](FileOffset o, unsigned row) { viewer.RenderLeft(scanline, o, row); });
+    // The layout of a line is shared by its rows, so it is made once per line here, too.
+    ROMviewer::LineLayout layout;
+    auto LayOut = [&](FileOffset o, unsigned row)
+    {
+        if(row == 0) viewer.layouts.Build(layout, &viewer.image[0], o, viewer.LineWidth(o, rs), rs.transliterate, rs.transliterate2);
+    };
+    PerScanline("hex",  hex_begin,  [&](FileOffset o, unsigned row) { LayOut(o, row); viewer.RenderHex(scanline, layout, {0,0}, row); });
+    PerScanline("text", text_begin, [&](FileOffset o, unsigned row) { LayOut(o, row); viewer.RenderText(scanline, layout, {0,0}, row, rs); });
+    {
+        double secs = Measure([&]
+        {
+            for(unsigned y=0; y<viewer.GFXviewHeight; ++y)
+            {
+                unsigned yu = y / viewer.GFXviewScale;
+                viewer.RenderGFX(scanline, chr_begin + (yu/8)*16*16 + yu%8, viewer.GFXviewWidth, viewer.GFXviewScale, 16);
+            }
+        });
+        results.push_back({ "chr", secs / viewer.GFXviewHeight * 1e9, &NsPerScanline });
+    }
+    {
+        const auto& colors = viewer.colors.text[0][TextPlain];
+        double secs = Measure([&]
+        {
+            for(unsigned y=0; y<Scanlines; ++y)
+                for(unsigned x=0; x<CharsPerLine; ++x)
+                    viewer.glyphs.Put(scanline + x*FontWidth, colors, 'A' + x, y % FontHeight);
+        });
+        results.push_back({ "glyph", secs / (Scanlines * CharsPerLine) * 1e9, &NsPerGlyph });
+    }
+    {
+        crc32_t sum = 0;
+        double secs = Measure([&] { sum ^= ROMviewer::CheckSum(scanline, viewer.width*sizeof(Pixel)); });
+        results.push_back({ "checksum", viewer.width*sizeof(Pixel) / secs / 1e6, &MBperSec });
+    }
+    {
+        // Palette indexes into colors, as done for each uploaded row
+        std::vector<uint32_t> argb(viewer.width);
+        double secs = Measure([&] { viewer.palette.Expand(&argb[0], scanline, viewer.width); });
+        results.push_back({ "expand", secs * 1e9, &NsPerScanline });
+    }
+
+    // Whole scanlines of the dump
+    for(const auto& page: pages)
+    {
+        FileOffset ybegin = viewer.GetLineForOffset(page.begin) * FontHeight;
+        double secs = Measure([&]
+        {
+            for(unsigned y=0; y<Scanlines; ++y)
+            {
+                if(y % FontHeight == 0) viewer.PrepareLayout(ybegin + y, rs);
+                viewer.RenderDumpLine(scanline, ybegin + y, rs);
+            }
+        });
+        std::string name = std::string("line-") + page.name;
+        results.push_back({ name, secs / Scanlines * 1e9,                   &NsPerScanline });
+        results.push_back({ name, BytesPerScanline * Scanlines / secs / 1e6, &MBperSec });
+    }
+
+    // Full frames, the way the viewer draws them: on all worker threads, with checksums
+    for(const auto& page: pages)
+    {
+        viewer.ScrollTo(viewer.GetLineForOffset(page.begin) * FontHeight);
+        double secs = Measure([&]
+        {
+            viewer.MakeDirty();
+            viewer.RefreshFrame(std::chrono::seconds(60));
+        });
+        std::string name = std::string("frame-") + page.name;
+        results.push_back({ name, secs * 1e3, &MsPerFrame });
+        results.push_back({ name, BytesPerScanline * viewer.height / secs / 1e6, &MBperSec });
+    }
+
+    std::map<std::string,double> old;
+    if(compare && !LoadJSON(compare, old))
+        std::perror(compare);
+
+    std::printf("PRG %u kB, CHR %u kB, %u threads, CRC32 engine: %s\n",
+        prg_kb, chr_kb, viewer.workers.Size(), crc32_engine_name());
+    for(const auto& r: results)
+    {
+        std::printf("%-12s %10.2f %-12s", r.name.c_str(), r.value, r.unit->label);
+        auto i = old.find(r.Key());
+        if(i != old.end() && i->second != 0)
+        {
+            double change = (r.value - i->second) / i->second * 100;
+            std::printf(" was %10.2f  %+6.1f%% (%s)", i->second, change,
+                (change > 0) == r.unit->higher_is_better ? "better" : "worse");
+        }
+        std::printf("\n");
+    }
+
+    if(json && !SaveJSON(json, results, prg_kb, chr_kb, viewer.workers.Size()))
+    {
+        std::perror(json);
+        return 1;
+    }
+    return 0;
+}
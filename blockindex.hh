@@ -0,0 +1,186 @@
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cmath>
+
+// What a block of the image looks like it contains.
+enum BlockClass { BlockUnknown, BlockFill, BlockText, BlockTiles, BlockPacked, BlockData, NumBlockClasses };
+
+/* Classification of the image in fixed-size blocks, built in the background.
+ *
+ * For each block, four scores are kept in one 32-bit word:
+ *   entropy  Shannon entropy of the bytes, in 1/32 bits per byte
+ *   fill     fraction of 00 and FF bytes, 0-255
+ *   text     fraction of bytes that the text view shows as printable
+ *            characters under the current transliteration, 0-255
+ *   tiles    how much the block looks like 2bpp tiles, i.e. how often
+ *            a tile row differs from the row above by at most two pixels, 0-255
+ *
+ * A thread walks the image from the start and publishes each block as
+ * it is done; Restart() makes it start over, e.g. when the transliteration
+ * changes. Until a block is analyzed again, its old scores remain readable.
+ * Blocks are 1 kB, or larger for huge images, so that the whole index
+ * stays within a few megabytes.
+ */
+class BlockIndex
+{
+public:
+    struct Stats { unsigned char entropy, fill, text, tiles; };
+
+private:
+    const ROMimage& image;
+    FileOffset      block_size = 1024;
+    std::size_t     n_blocks   = 0;
+
+    std::unique_ptr<std::atomic<uint_least32_t>[]> blocks;
+    std::atomic<std::size_t> done{0};   // Blocks analyzed since the last restart
+    std::atomic<std::size_t> filled{0}; // Blocks that have ever been analyzed
+
+    std::thread              thread;
+    std::mutex               lock;
+    std::condition_variable  wake;
+    unsigned                 request = 0, params = 0;
+    bool                     quit = false;
+
+    static uint_least32_t Pack(Stats s)
+    {
+        return s.entropy | (s.fill << 8) | (s.text << 16) | (uint_least32_t(s.tiles) << 24);
+    }
+    static Stats Unpack(uint_least32_t v)
+    {
+        return { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+    }
+
+    Stats Analyze(std::size_t n, unsigned char transliterate, unsigned char transliterate2) const
+    {
+        const FileOffset     begin = n * block_size;
+        const std::size_t    len   = std::min<FileOffset>(block_size, image.size() - begin);
+        const unsigned char* p     = &image[begin];
+
+        unsigned hist[256] = {};
+        for(std::size_t i=0; i<len; ++i) ++hist[p[i]];
+
+        double entropy = 0;
+        unsigned printable = 0;
+        for(unsigned b=0; b<256; ++b)
+        {
+            if(hist[b])
+                entropy -= hist[b] * std::log2(hist[b] / double(len));
+            unsigned c = TextViewChar(b, transliterate, transliterate2);
+            if(c >= 0x20 && c < 0x7F) printable += hist[b];
+        }
+        entropy /= len;
+
+        unsigned coherent = 0, rows = 0;
+        for(std::size_t t=0; t+16 <= len; t += 16)
+            for(unsigned plane=0; plane<16; plane += 8)
+                for(unsigned r=1; r<8; ++r, ++rows)
+                    coherent += __builtin_popcount(p[t+plane+r] ^ p[t+plane+r-1]) <= 2;
+
+        Stats s;
+        s.entropy = std::min(255u, unsigned(entropy * 32));
+        s.fill    = (hist[0x00] + hist[0xFF]) * 255 / len;
+        s.text    = printable * 255 / len;
+        s.tiles   = rows ? coherent * 255 / rows : 0;
+        return s;
+    }
+
+    void Thread()
+    {
+        unsigned seen = 0;
+        std::unique_lock<std::mutex> l(lock);
+        for(;;)
+        {
+            wake.wait(l, [&]{ return quit || request != seen; });
+            if(quit) return;
+            seen = request;
+            const unsigned char t = params, t2 = params >> 8;
+            l.unlock();
+
+            done.store(0, std::memory_order_release);
+            for(std::size_t n=0; n<n_blocks; ++n)
+            {
+                // Check now and then whether to start over or to quit.
+                if(n % 64 == 0)
+                {
+                    std::lock_guard<std::mutex> g(lock);
+                    if(quit || request != seen) break;
+                }
+                blocks[n].store(Pack(Analyze(n, t, t2)), std::memory_order_relaxed);
+                done.store(n+1, std::memory_order_release);
+                if(filled.load(std::memory_order_relaxed) <= n)
+                    filled.store(n+1, std::memory_order_release);
+            }
+            l.lock();
+        }
+    }
+
+public:
+    explicit BlockIndex(const ROMimage& img) : image(img)
+    {
+        while(image.size() / block_size > (1u << 20)) block_size *= 2;
+        n_blocks = (image.size() + block_size - 1) / block_size;
+        blocks.reset(new std::atomic<uint_least32_t>[n_blocks]());
+    }
+    ~BlockIndex()
+    {
+        { std::lock_guard<std::mutex> l(lock);
+          quit = true; }
+        wake.notify_all();
+        if(thread.joinable()) thread.join();
+    }
+    BlockIndex(const BlockIndex&) = delete;
+    void operator=(const BlockIndex&) = delete;
+
+    // (Re)starts indexing with the given transliteration.
+    // The thread is only created when this is first called.
+    void Restart(unsigned char transliterate, unsigned char transliterate2)
+    {
+        { std::lock_guard<std::mutex> l(lock);
+          params = transliterate | (transliterate2 << 8);
+          ++request; }
+        if(!thread.joinable())
+            thread = std::thread(&BlockIndex::Thread, this);
+        wake.notify_all();
+    }
+
+    FileOffset  BlockSize() const { return block_size; }
+    std::size_t NumBlocks() const { return n_blocks; }
+    // Number of blocks from the start that have been analyzed.
+    std::size_t Done() const      { return done.load(std::memory_order_acquire); }
+
+    bool Get(std::size_t n, Stats& s) const
+    {
+        if(n >= filled.load(std::memory_order_acquire)) return false;
+        s = Unpack(blocks[n].load(std::memory_order_relaxed));
+        return true;
+    }
+
+    static BlockClass Classify(Stats s)
+    {
+        if(s.fill    >= 230) return BlockFill;
+        if(s.text    >= 230) return BlockText;
+        if(s.tiles   >= 150 && s.entropy < 7*32) return BlockTiles;
+        if(s.entropy >= 233) return BlockPacked; // 7.3 bits per byte
+        return BlockData;
+    }
+
+    // The most common class among blocks begin..end-1.
+    // Huge ranges are sampled rather than counted in full.
+    BlockClass Dominant(std::size_t begin, std::size_t end) const
+    {
+        unsigned count[NumBlockClasses] = {};
+        const std::size_t step = std::max<std::size_t>(1, (end - begin) / 256);
+        Stats s;
+        for(std::size_t n=begin; n<end; n += step)
+            ++count[Get(n, s) ? Classify(s) : BlockUnknown];
+
+        unsigned best = BlockUnknown;
+        for(unsigned c=1; c<NumBlockClasses; ++c)
+            if(count[c] > count[best]) best = c;
+        return BlockClass(best);
+    }
+};
@@ -0,0 +1,155 @@
+#include <algorithm>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define CHR_HAVE_SIMD 1
+# include <immintrin.h>
+#endif
+
+/* NES 2bpp tile row decoding.
+ *
+ * One row of a tile is two bytes, eight bytes apart: the low and high bitplanes.
+ * Pixel p (0 = leftmost) has the palette index
+ *     ((lo >> (7-p)) & 1) | (((hi >> (7-p)) & 1) << 1).
+ *
+ * DecodeTileRows() expands ntiles tiles, which are stride bytes apart,
+ * into 8*Scale pixels each. The SIMD versions decode several tiles at once,
+ * one byte lane per pixel: they compare the broadcast bitplanes against
+ * per-lane bit masks, and select the palette entries with masks instead
+ * of table lookups. SSE2 does two tiles at a time, AVX2 four.
+ */
+template<unsigned Scale>
+static void DecodeTileRowsScalar(Pixel* out, const unsigned char* src, unsigned stride,
+                                 unsigned ntiles, const Pixel palette[4])
+{
+    for(unsigned t=0; t<ntiles; ++t, src += stride)
+    {
+        unsigned lo = src[0], hi = src[8];
+        for(unsigned p=0; p<8; ++p, out += Scale)
+            std::fill_n(out, Scale, palette[((lo >> (7-p)) & 1) | (((hi >> (7-p)) & 1) << 1)]);
+    }
+}
+
+#ifdef CHR_HAVE_SIMD
+template<unsigned Scale>
+static void DecodeTileRowsSSE2(Pixel* out, const unsigned char* src, unsigned stride,
+                               unsigned ntiles, const Pixel palette[4])
+{
+    const __m128i bits = _mm_setr_epi8(char(0x80),0x40,0x20,0x10,0x08,0x04,0x02,0x01,
+                                       char(0x80),0x40,0x20,0x10,0x08,0x04,0x02,0x01);
+    const __m128i c0  = _mm_set1_epi8(palette[0]), c01 = _mm_set1_epi8(palette[0] ^ palette[1]);
+    const __m128i c2  = _mm_set1_epi8(palette[2]), c23 = _mm_set1_epi8(palette[2] ^ palette[3]);
+
+    unsigned t = 0;
+    for(; t+2 <= ntiles; t += 2, src += 2*stride, out += 16*Scale)
+    {
+        __m128i lo = _mm_unpacklo_epi64(_mm_set1_epi8(src[0]), _mm_set1_epi8(src[stride]));
+        __m128i hi = _mm_unpacklo_epi64(_mm_set1_epi8(src[8]), _mm_set1_epi8(src[stride+8]));
+        __m128i m1 = _mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits);
+        __m128i m2 = _mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits);
+        __m128i low  = _mm_xor_si128(c0, _mm_and_si128(m1, c01));
+        __m128i high = _mm_xor_si128(c2, _mm_and_si128(m1, c23));
+        __m128i v    = _mm_xor_si128(low, _mm_and_si128(m2, _mm_xor_si128(low, high)));
+
+        if(Scale == 1)
+            _mm_storeu_si128((__m128i*)out, v);
+        else if(Scale == 2)
+        {
+            _mm_storeu_si128((__m128i*)(out+ 0), _mm_unpacklo_epi8(v, v));
+            _mm_storeu_si128((__m128i*)(out+16), _mm_unpackhi_epi8(v, v));
+        }
+        else if(Scale == 4)
+        {
+            __m128i a = _mm_unpacklo_epi8(v, v), b = _mm_unpackhi_epi8(v, v);
+            _mm_storeu_si128((__m128i*)(out+ 0), _mm_unpacklo_epi16(a, a));
+            _mm_storeu_si128((__m128i*)(out+16), _mm_unpackhi_epi16(a, a));
+            _mm_storeu_si128((__m128i*)(out+32), _mm_unpacklo_epi16(b, b));
+            _mm_storeu_si128((__m128i*)(out+48), _mm_unpackhi_epi16(b, b));
+        }
+        else
+        {
+            alignas(16) Pixel tmp[16];
+            _mm_store_si128((__m128i*)tmp, v);
+            for(unsigned p=0; p<16; ++p) std::fill_n(out + p*Scale, Scale, tmp[p]);
+        }
+    }
+    DecodeTileRowsScalar<Scale>(out, src, stride, ntiles - t, palette);
+}
+
+template<unsigned Scale>
+__attribute__((target("avx2")))
+static void DecodeTileRowsAVX2(Pixel* out, const unsigned char* src, unsigned stride,
+                               unsigned ntiles, const Pixel palette[4])
+{
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+    const __m256i c0  = _mm256_set1_epi8(palette[0]), c01 = _mm256_set1_epi8(palette[0] ^ palette[1]);
+    const __m256i c2  = _mm256_set1_epi8(palette[2]), c23 = _mm256_set1_epi8(palette[2] ^ palette[3]);
+    const uint64_t Spread = 0x0101010101010101; // Copies a byte into all eight
+
+    unsigned t = 0;
+    for(; t+4 <= ntiles; t += 4, src += 4*stride, out += 32*Scale)
+    {
+        __m256i lo = _mm256_setr_epi64x(src[0]*Spread, src[stride]*Spread, src[2*stride]*Spread, src[3*stride]*Spread);
+        __m256i hi = _mm256_setr_epi64x(src[8]*Spread, src[stride+8]*Spread, src[2*stride+8]*Spread, src[3*stride+8]*Spread);
+        __m256i m1 = _mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits);
+        __m256i m2 = _mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits);
+        __m256i low  = _mm256_xor_si256(c0, _mm256_and_si256(m1, c01));
+        __m256i high = _mm256_xor_si256(c2, _mm256_and_si256(m1, c23));
+        __m256i v    = _mm256_xor_si256(low, _mm256_and_si256(m2, _mm256_xor_si256(low, high)));
+
+        // The unpacks work within 128-bit lanes, i.e. on tiles 0,1 and 2,3 apart.
+        if(Scale == 1)
+            _mm256_storeu_si256((__m256i*)out, v);
+        else if(Scale == 2)
+        {
+            __m256i a = _mm256_unpacklo_epi8(v, v), b = _mm256_unpackhi_epi8(v, v); // Tiles 0,2 and 1,3
+            _mm256_storeu_si256((__m256i*)(out+ 0), _mm256_permute2x128_si256(a, b, 0x20));
+            _mm256_storeu_si256((__m256i*)(out+32), _mm256_permute2x128_si256(a, b, 0x31));
+        }
+        else if(Scale == 4)
+        {
+            __m256i a = _mm256_unpacklo_epi8(v, v), b = _mm256_unpackhi_epi8(v, v);
+            __m256i a0 = _mm256_unpacklo_epi16(a, a), a1 = _mm256_unpackhi_epi16(a, a); // Halves of tiles 0,2
+            __m256i b0 = _mm256_unpacklo_epi16(b, b), b1 = _mm256_unpackhi_epi16(b, b); // Halves of tiles 1,3
+            _mm256_storeu_si256((__m256i*)(out+ 0), _mm256_permute2x128_si256(a0, a1, 0x20));
+            _mm256_storeu_si256((__m256i*)(out+32), _mm256_permute2x128_si256(b0, b1, 0x20));
+            _mm256_storeu_si256((__m256i*)(out+64), _mm256_permute2x128_si256(a0, a1, 0x31));
+            _mm256_storeu_si256((__m256i*)(out+96), _mm256_permute2x128_si256(b0, b1, 0x31));
+        }
+        else
+        {
+            alignas(32) Pixel tmp[32];
+            _mm256_store_si256((__m256i*)tmp, v);
+            for(unsigned p=0; p<32; ++p) std::fill_n(out + p*Scale, Scale, tmp[p]);
+        }
+    }
+    DecodeTileRowsSSE2<Scale>(out, src, stride, ntiles - t, palette);
+}
+#endif
+
+template<unsigned Scale>
+static void DecodeTileRows(Pixel* out, const unsigned char* src, unsigned stride,
+                           unsigned ntiles, const Pixel palette[4])
+{
+#ifdef CHR_HAVE_SIMD
+    static const bool have_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    if(have_avx2)
+        DecodeTileRowsAVX2<Scale>(out, src, stride, ntiles, palette);
+    else
+        DecodeTileRowsSSE2<Scale>(out, src, stride, ntiles, palette);
+#else
+    DecodeTileRowsScalar<Scale>(out, src, stride, ntiles, palette);
+#endif
+}
+
+// The same, for a scale that is only known at run time (1 to 4).
+static void DecodeTileRows(Pixel* out, const unsigned char* src, unsigned stride,
+                           unsigned ntiles, unsigned scale, const Pixel palette[4])
+{
+    switch(scale)
+    {
+        case 1:  DecodeTileRows<1>(out, src, stride, ntiles, palette); break;
+        case 2:  DecodeTileRows<2>(out, src, stride, ntiles, palette); break;
+        case 3:  DecodeTileRows<3>(out, src, stride, ntiles, palette); break;
+        default: DecodeTileRows<4>(out, src, stride, ntiles, palette); break;
+    }
+}
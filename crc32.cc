@@ -1,6 +1,12 @@
 /*** CRC32 calculation (CRC::update) ***/
 #include "crc32.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+# define CRC32_HAVE_CLMUL 1
+# include <immintrin.h>
+# include <cpuid.h>
+#endif
+
 #ifdef __GNUC__
 # define likely(x)       __builtin_expect(!!(x), 1)
 # define unlikely(x)     __builtin_expect(!!(x), 0)
@@ -53,78 +59,201 @@ namespace {
       R(0x80),R(0x90),R(0xA0),R(0xB0), R(0xC0),R(0xD0),R(0xE0),R(0xF0) }; 
     #undef R
     #undef B4
-}
-
-uint_fast32_t crc32_update(uint_fast32_t crc, unsigned/* char */b) // __attribute__((pure))
-{
-    return ((crc >> 8) /* & 0x00FFFFFF*/) ^ crctable[/*(unsigned char)*/(crc^b)&0xFF];
-}
 
-crc32_t crc32_calc(const unsigned char* buf, unsigned long size)
-{
-    return crc32_calc_upd(crc32_startvalue, buf, size);
-}
-crc32_t crc32_calc_upd(crc32_t c, const unsigned char* buf, unsigned long size)
-{
-    uint_fast32_t value = c;
-
-#if 0
-    unsigned long pos = 0;
-    while(size-- > 0) value = crc32_update(value, buf[pos++]);
-#endif
+    /* Slice-by-16 tables, also constructed at compile-time.
+     * slices.t[k][n] is the CRC of byte n followed by k zero bytes,
+     * which lets us consume sixteen input bytes with sixteen independent lookups. */
+    struct slice_tables
+    {
+        uint_least32_t t[16][256];
 
-#if 1
-    for(unsigned long p=0; p<size; ++p) value = crc32_update(value, buf[p]);
-#endif
+        constexpr slice_tables() : t{}
+        {
+            for(unsigned n=0; n<256; ++n)
+            {
+                uint_fast32_t crc = n;
+                for(unsigned b=0; b<8; ++b)
+                    crc = (crc & 1) ? (crc32_poly ^ (crc >> 1)) : (crc >> 1);
+                t[0][n] = crc;
+            }
+            for(unsigned k=1; k<16; ++k)
+                for(unsigned n=0; n<256; ++n)
+                    t[k][n] = (t[k-1][n] >> 8) ^ t[0][t[k-1][n] & 0xFF];
+        }
+    };
+    static constexpr slice_tables slices{};
 
-#if 0
-    unsigned unaligned_length = (4 - (unsigned long)(buf)) & 3;
-    if(size < unaligned_length) unaligned_length = size;
-    switch(unaligned_length)
+    uint_fast32_t crc32_slice16(uint_fast32_t crc, const unsigned char* buf, unsigned long size)
     {
-        case 3: value = crc32_update(value, *buf++);
-        case 2: value = crc32_update(value, *buf++);
-        case 1: value = crc32_update(value, *buf++);
-                size -= unaligned_length;
-        case 0: break;
+        const auto& t = slices.t;
+        for(; size >= 16; size -= 16, buf += 16)
+        {
+            /* Bytes are assembled explicitly so that this works regardless of
+             * endianness; on little-endian targets it compiles into a single load. */
+            uint_fast32_t a = crc ^ ( (uint_fast32_t(buf[0])      ) | (uint_fast32_t(buf[1]) <<  8)
+                                    | (uint_fast32_t(buf[2]) << 16) | (uint_fast32_t(buf[3]) << 24) );
+            crc = t[15][ a        & 0xFF] ^ t[14][(a >>  8) & 0xFF]
+                ^ t[13][(a >> 16) & 0xFF] ^ t[12][(a >> 24) & 0xFF]
+                ^ t[11][buf[ 4]] ^ t[10][buf[ 5]] ^ t[ 9][buf[ 6]] ^ t[ 8][buf[ 7]]
+                ^ t[ 7][buf[ 8]] ^ t[ 6][buf[ 9]] ^ t[ 5][buf[10]] ^ t[ 4][buf[11]]
+                ^ t[ 3][buf[12]] ^ t[ 2][buf[13]] ^ t[ 1][buf[14]] ^ t[ 0][buf[15]];
+        }
+        while(size-- > 0)
+            crc = (crc >> 8) ^ t[0][(crc ^ *buf++) & 0xFF];
+        return crc;
     }
-    for(; size >= 4; size -= 4, buf += 4)
-        value = crc32_update(
-                crc32_update(
-                crc32_update(
-                crc32_update(value, buf[0]),
-                                    buf[1]),
-                                    buf[2]),
-                                    buf[3]);
-    switch(size)
+
+#ifdef CRC32_HAVE_CLMUL
+    /* Carry-less multiplication folding, as described in Intel's paper
+     * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+     * The constants are for the bit-reflected domain of crc32_poly.
+     * Requires size >= 64 and size a multiple of 16. */
+    __attribute__((target("pclmul,sse4.1")))
+    uint_fast32_t crc32_clmul_fold(uint_fast32_t crc, const unsigned char* buf, unsigned long size)
     {
-        case 3: value = crc32_update(value, *buf++);
-        case 2: value = crc32_update(value, *buf++);
-        case 1: value = crc32_update(value, *buf++);
-        case 0: break;
+        alignas(16) static const uint64_t k1k2[2] = { 0x0154442bd4, 0x01c6e41596 };
+        alignas(16) static const uint64_t k3k4[2] = { 0x01751997d0, 0x00ccaa009e };
+        alignas(16) static const uint64_t k5k0[2] = { 0x0163cd6124, 0x0000000000 };
+        alignas(16) static const uint64_t poly[2] = { 0x01db710641, 0x01f7011641 };
+
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+        x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+        x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+        x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+        x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(uint32_t(crc))));
+        x0 = _mm_load_si128((const __m128i*)k1k2);
+        buf += 64; size -= 64;
+
+        // Fold four 128-bit lanes in parallel, 64 bytes at a time
+        for(; size >= 64; buf += 64, size -= 64)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 0x30)));
+        }
+
+        // Fold the four lanes into one
+        x0 = _mm_load_si128((const __m128i*)k3k4);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        // Fold the remaining 16-byte blocks
+        for(; size >= 16; buf += 16, size -= 16)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)buf)), x5);
+        }
+
+        // Reduce 128 bits into 64
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduction into 32 bits
+        x0 = _mm_load_si128((const __m128i*)poly);
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        return uint32_t(_mm_extract_epi32(x1, 1));
     }
-#endif
 
-#if 0 /* duff's device -- no gains observed over the simple loop above */
-    if(__builtin_expect( (size!=0), 1l ))
+    uint_fast32_t crc32_clmul(uint_fast32_t crc, const unsigned char* buf, unsigned long size)
     {
-        { if(__builtin_expect( !(size&1), 1l )) goto case_0;
-          --buf; goto case_1;
-        }
-        //switch(size % 2)
+        if(size >= 64)
         {
-            //default: 
-                 do { size -= 2; buf += 2;
-            case_0: value = crc32_update(value, buf[0]);
-            case_1: value = crc32_update(value, buf[1]);
-                    } while(size > 2);
+            unsigned long chunk = size & ~15ul;
+            crc = crc32_clmul_fold(crc, buf, chunk);
+            buf += chunk;
+            size -= chunk;
         }
+        return crc32_slice16(crc, buf, size);
+    }
+
+    bool crc32_clmul_supported()
+    {
+        unsigned a,b,c,d;
+        return __get_cpuid(1, &a,&b,&c,&d) && (c & bit_PCLMUL) && (c & bit_SSE4_1);
     }
 #endif
 
-#if 0
-    while(size-- > 0) value = crc32_update(value, *buf++);
+    typedef uint_fast32_t (*crc32_engine)(uint_fast32_t, const unsigned char*, unsigned long);
+
+    struct crc32_engine_choice { crc32_engine func; const char* name; };
+
+    crc32_engine_choice crc32_select()
+    {
+#ifdef CRC32_HAVE_CLMUL
+        if(crc32_clmul_supported()) return { crc32_clmul, "pclmulqdq" };
 #endif
-    
+        return { crc32_slice16, "slice-by-16" };
+    }
+    const crc32_engine_choice& crc32_chosen()
+    {
+        static const crc32_engine_choice choice = crc32_select();
+        return choice;
+    }
+}
+
+uint_fast32_t crc32_update(uint_fast32_t crc, unsigned/* char */b) // __attribute__((pure))
+{
+    return ((crc >> 8) /* & 0x00FFFFFF*/) ^ crctable[/*(unsigned char)*/(crc^b)&0xFF];
+}
+
+crc32_t crc32_calc(const unsigned char* buf, unsigned long size)
+{
+    return crc32_calc_upd(crc32_startvalue, buf, size);
+}
+crc32_t crc32_calc_upd(crc32_t c, const unsigned char* buf, unsigned long size)
+{
+    return crc32_chosen().func(c, buf, size);
+}
+
+crc32_t crc32_calc_upd_bytewise(crc32_t c, const unsigned char* buf, unsigned long size)
+{
+    uint_fast32_t value = c;
+    for(unsigned long p=0; p<size; ++p) value = crc32_update(value, buf[p]);
     return value;
 }
+crc32_t crc32_calc_upd_slice16(crc32_t c, const unsigned char* buf, unsigned long size)
+{
+    return crc32_slice16(c, buf, size);
+}
+crc32_t crc32_calc_upd_clmul(crc32_t c, const unsigned char* buf, unsigned long size)
+{
+#ifdef CRC32_HAVE_CLMUL
+    static const bool supported = crc32_clmul_supported();
+    if(supported) return crc32_clmul(c, buf, size);
+#endif
+    return crc32_slice16(c, buf, size);
+}
+const char* crc32_engine_name(void)
+{
+    return crc32_chosen().name;
+}
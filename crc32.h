@@ -24,6 +24,15 @@ extern uint_fast32_t crc32_update(uint_fast32_t c, unsigned/* char*/b)
 extern crc32_t crc32_calc(const unsigned char* buf, unsigned long size);
 extern crc32_t crc32_calc_upd(crc32_t c, const unsigned char* buf, unsigned long size);
 
+/* crc32_calc_upd() picks the fastest engine supported by the CPU at runtime.
+ * The individual engines are also exposed for verification and benchmarking.
+ * crc32_calc_upd_clmul() falls back to slice-by-16 when PCLMULQDQ is absent.
+ */
+extern crc32_t crc32_calc_upd_bytewise(crc32_t c, const unsigned char* buf, unsigned long size);
+extern crc32_t crc32_calc_upd_slice16(crc32_t c, const unsigned char* buf, unsigned long size);
+extern crc32_t crc32_calc_upd_clmul(crc32_t c, const unsigned char* buf, unsigned long size);
+extern const char* crc32_engine_name(void);
+
 #ifdef __cplusplus
 }
 #endif
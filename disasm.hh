@@ -0,0 +1,300 @@
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+// The official 6502 instructions: mnemonic and length in bytes of each opcode.
+// Length 0 = not an official instruction.
+static constexpr struct { char name[4]; unsigned char length; } Opcodes6502[256] =
+{
+        {"BRK",1}, {"ORA",2}, {"",   0}, {"",   0}, {"",   0}, {"ORA",2}, {"ASL",2}, {"",   0},  // 00-07
+        {"PHP",1}, {"ORA",2}, {"ASL",1}, {"",   0}, {"",   0}, {"ORA",3}, {"ASL",3}, {"",   0},  // 08-0F
+        {"BPL",2}, {"ORA",2}, {"",   0}, {"",   0}, {"",   0}, {"ORA",2}, {"ASL",2}, {"",   0},  // 10-17
+        {"CLC",1}, {"ORA",3}, {"",   0}, {"",   0}, {"",   0}, {"ORA",3}, {"ASL",3}, {"",   0},  // 18-1F
+        {"JSR",3}, {"AND",2}, {"",   0}, {"",   0}, {"BIT",2}, {"AND",2}, {"ROL",2}, {"",   0},  // 20-27
+        {"PLP",1}, {"AND",2}, {"ROL",1}, {"",   0}, {"BIT",3}, {"AND",3}, {"ROL",3}, {"",   0},  // 28-2F
+        {"BMI",2}, {"AND",2}, {"",   0}, {"",   0}, {"",   0}, {"AND",2}, {"ROL",2}, {"",   0},  // 30-37
+        {"SEC",1}, {"AND",3}, {"",   0}, {"",   0}, {"",   0}, {"AND",3}, {"ROL",3}, {"",   0},  // 38-3F
+        {"RTI",1}, {"EOR",2}, {"",   0}, {"",   0}, {"",   0}, {"EOR",2}, {"LSR",2}, {"",   0},  // 40-47
+        {"PHA",1}, {"EOR",2}, {"LSR",1}, {"",   0}, {"JMP",3}, {"EOR",3}, {"LSR",3}, {"",   0},  // 48-4F
+        {"BVC",2}, {"EOR",2}, {"",   0}, {"",   0}, {"",   0}, {"EOR",2}, {"LSR",2}, {"",   0},  // 50-57
+        {"CLI",1}, {"EOR",3}, {"",   0}, {"",   0}, {"",   0}, {"EOR",3}, {"LSR",3}, {"",   0},  // 58-5F
+        {"RTS",1}, {"ADC",2}, {"",   0}, {"",   0}, {"",   0}, {"ADC",2}, {"ROR",2}, {"",   0},  // 60-67
+        {"PLA",1}, {"ADC",2}, {"ROR",1}, {"",   0}, {"JMP",3}, {"ADC",3}, {"ROR",3}, {"",   0},  // 68-6F
+        {"BVS",2}, {"ADC",2}, {"",   0}, {"",   0}, {"",   0}, {"ADC",2}, {"ROR",2}, {"",   0},  // 70-77
+        {"SEI",1}, {"ADC",3}, {"",   0}, {"",   0}, {"",   0}, {"ADC",3}, {"ROR",3}, {"",   0},  // 78-7F
+        {"",   0}, {"STA",2}, {"",   0}, {"",   0}, {"STY",2}, {"STA",2}, {"STX",2}, {"",   0},  // 80-87
+        {"DEY",1}, {"",   0}, {"TXA",1}, {"",   0}, {"STY",3}, {"STA",3}, {"STX",3}, {"",   0},  // 88-8F
+        {"BCC",2}, {"STA",2}, {"",   0}, {"",   0}, {"STY",2}, {"STA",2}, {"STX",2}, {"",   0},  // 90-97
+        {"TYA",1}, {"STA",3}, {"TXS",1}, {"",   0}, {"",   0}, {"STA",3}, {"",   0}, {"",   0},  // 98-9F
+        {"LDY",2}, {"LDA",2}, {"LDX",2}, {"",   0}, {"LDY",2}, {"LDA",2}, {"LDX",2}, {"",   0},  // A0-A7
+        {"TAY",1}, {"LDA",2}, {"TAX",1}, {"",   0}, {"LDY",3}, {"LDA",3}, {"LDX",3}, {"",   0},  // A8-AF
+        {"BCS",2}, {"LDA",2}, {"",   0}, {"",   0}, {"LDY",2}, {"LDA",2}, {"LDX",2}, {"",   0},  // B0-B7
+        {"CLV",1}, {"LDA",3}, {"TSX",1}, {"",   0}, {"LDY",3}, {"LDA",3}, {"LDX",3}, {"",   0},  // B8-BF
+        {"CPY",2}, {"CMP",2}, {"",   0}, {"",   0}, {"CPY",2}, {"CMP",2}, {"DEC",2}, {"",   0},  // C0-C7
+        {"INY",1}, {"CMP",2}, {"DEX",1}, {"",   0}, {"CPY",3}, {"CMP",3}, {"DEC",3}, {"",   0},  // C8-CF
+        {"BNE",2}, {"CMP",2}, {"",   0}, {"",   0}, {"",   0}, {"CMP",2}, {"DEC",2}, {"",   0},  // D0-D7
+        {"CLD",1}, {"CMP",3}, {"",   0}, {"",   0}, {"",   0}, {"CMP",3}, {"DEC",3}, {"",   0},  // D8-DF
+        {"CPX",2}, {"SBC",2}, {"",   0}, {"",   0}, {"CPX",2}, {"SBC",2}, {"INC",2}, {"",   0},  // E0-E7
+        {"INX",1}, {"SBC",2}, {"NOP",1}, {"",   0}, {"CPX",3}, {"SBC",3}, {"INC",3}, {"",   0},  // E8-EF
+        {"BEQ",2}, {"SBC",2}, {"",   0}, {"",   0}, {"",   0}, {"SBC",2}, {"INC",2}, {"",   0},  // F0-F7
+        {"SED",1}, {"SBC",3}, {"",   0}, {"",   0}, {"",   0}, {"SBC",3}, {"INC",3}, {"",   0},  // F8-FF
+};
+
+// The operand of the official 6502 instruction in p[0..2] as it is written in
+// assembly ("#$12", "$1234,X", "($12),Y" ...), or nothing for the implied and
+// accumulator forms. Branches show where they go, from their own address "pc".
+// Writes at most 8 characters and the terminator to "out"; returns how many.
+static unsigned FormatOperand6502(char* out, const unsigned char* p, unsigned pc)
+{
+    const unsigned char op   = p[0];
+    const unsigned      byte = p[1], word = p[1] | (p[2] << 8);
+    if(Opcodes6502[op].length < 2)
+        return out[0] = '\0', 0;
+    if((op & 0x1F) == 0x10)                                 // Branches
+        return std::sprintf(out, "$%04X", (pc + 2 + (signed char)p[1]) & 0xFFFF);
+    if(op == 0x20 || op == 0x4C)                            // JSR, JMP
+        return std::sprintf(out, "$%04X", word);
+    if(op == 0x6C)
+        return std::sprintf(out, "($%04X)", word);
+
+    // The rest are aaabbbcc, where bbb selects the addressing mode.
+    // LDX and STX index with Y where the others index with X.
+    const char index = (op == 0x96 || op == 0xB6 || op == 0xBE) ? 'Y' : 'X';
+    switch((op >> 2) & 7)
+    {
+        case 0:  return (op & 3) == 1 ? std::sprintf(out, "($%02X,X)", byte) : std::sprintf(out, "#$%02X", byte);
+        case 1:  return std::sprintf(out, "$%02X", byte);
+        case 2:  return std::sprintf(out, "#$%02X", byte);
+        case 3:  return std::sprintf(out, "$%04X", word);
+        case 4:  return std::sprintf(out, "($%02X),Y", byte);
+        case 5:  return std::sprintf(out, "$%02X,%c", byte, index);
+        case 6:  return std::sprintf(out, "$%04X,Y", word);
+        default: return std::sprintf(out, "$%04X,%c", word, index);
+    }
+}
+
+/* Instruction boundaries in the PRG banks, built in the background.
+ *
+ * Each 16 kB bank is disassembled on its own, at the CPU address that it is
+ * assumed to be mapped at. In a bank mapped at $C000, the code is first traced
+ * from the NMI, reset and IRQ vectors at its end, following the jumps, calls
+ * and branches that stay within the bank (recursive descent). The bytes that
+ * were not reached are then decoded in order, skipping anything that is not
+ * an official instruction, and BRK, which there is mostly padding (linear sweep).
+ *
+ * The result is four bitmaps with one bit per byte, i.e. four 32-bit words
+ * per 32 bytes: where instructions begin, which of those were traced, which
+ * addresses are jumped or branched to, and which bytes are not code at all.
+ * A dump line is rendered from the words that cover it, without decoding anything.
+ *
+ * A thread rebuilds the banks whose address differs from the one they were
+ * built for, and publishes each bank as it is done, so changing the mapping
+ * of one bank redoes only that bank. Until then, its old words remain readable.
+ */
+class CodeIndex
+{
+public:
+    static constexpr unsigned BankSize = 16384, WordBytes = 32, WordsPerBank = BankSize / WordBytes;
+
+    struct Words { uint32_t starts, traced, targets, data; };
+
+private:
+    const ROMimage& image;
+    const FileOffset origin;
+    const unsigned   n_banks;
+
+    std::unique_ptr<std::atomic<uint_least32_t>[]> words; // Four per 32 bytes, all banks in order
+    std::unique_ptr<std::atomic<unsigned>[]>       built; // The address each bank was built for, 0 = not yet
+    std::atomic<std::size_t> published{0};                // Banks built so far
+
+    std::thread              thread;
+    std::mutex               lock;
+    std::condition_variable  wake;
+    std::vector<unsigned>    wanted;
+    unsigned                 request = 0;
+    bool                     quit = false;
+
+    static bool Test(const uint32_t* bits, unsigned n) { return bits[n / 32] >> (n % 32) & 1; }
+    static void Set(uint32_t* bits, unsigned n)        { bits[n / 32] |= 1u << (n % 32); }
+
+    // The instruction at p[n], in a bank of "size" bytes at "base": its length
+    // (0 if it is not one or does not fit), whether execution continues after it,
+    // and where it jumps or branches to within the bank (~0u if nowhere).
+    struct Instruction { unsigned length; bool next; unsigned target; };
+    static Instruction Decode(const unsigned char* p, unsigned n, unsigned size, unsigned base)
+    {
+        const unsigned char op = p[n];
+        const unsigned length  = Opcodes6502[op].length;
+        if(!length || n + length > size) return { 0, false, ~0u };
+
+        unsigned target = ~0u;
+        if((op & 0x1F) == 0x10)                          // Branches
+            target = (base + n + 2 + (signed char)p[n+1]) & 0xFFFF;
+        else if(op == 0x20 || op == 0x4C)                // JSR, JMP
+            target = p[n+1] | (p[n+2] << 8);
+        target = target - base < size ? target - base : ~0u;
+
+        // BRK, RTI, RTS and both JMPs do not continue.
+        const bool next = op != 0x00 && op != 0x40 && op != 0x60 && op != 0x4C && op != 0x6C;
+        return { length, next, target };
+    }
+
+    void Build(unsigned bank, unsigned base)
+    {
+        const FileOffset     begin = origin + FileOffset(bank) * BankSize;
+        const unsigned       size  = std::min<FileOffset>(BankSize, image.size() - begin);
+        const unsigned char* p     = &image[begin];
+
+        uint32_t starts[WordsPerBank] = {}, traced[WordsPerBank] = {}, targets[WordsPerBank] = {};
+        uint32_t covered[WordsPerBank] = {}; // Bytes that are decided: instructions and vectors
+        auto Free = [&](unsigned n, unsigned length)
+        {
+            for(unsigned k=0; k<length; ++k)
+                if(Test(covered, n+k)) return false;
+            return true;
+        };
+        auto Take = [&](unsigned n, unsigned length)
+        {
+            Set(starts, n);
+            for(unsigned k=0; k<length; ++k) Set(covered, n+k);
+        };
+
+        // Recursive descent from the vectors, if they are in this bank.
+        std::vector<unsigned> pending;
+        if(base + BankSize == 0x10000 && size == BankSize)
+            for(unsigned v = BankSize-6; v < BankSize; v += 2)
+            {
+                unsigned target = (p[v] | (p[v+1] << 8)) - base;
+                Set(covered, v);
+                Set(covered, v+1);
+                if(target < size) { Set(targets, target); pending.push_back(target); }
+            }
+        while(!pending.empty())
+        {
+            unsigned n = pending.back();
+            pending.pop_back();
+            for(;;)
+            {
+                Instruction i = Decode(p, n, size, base);
+                if(!i.length || !Free(n, i.length)) break; // Not code, or already traced
+                Take(n, i.length);
+                Set(traced, n);
+                if(i.target != ~0u) { Set(targets, i.target); pending.push_back(i.target); }
+                if(!i.next) break;
+                n += i.length;
+            }
+        }
+
+        // Linear sweep over the rest.
+        for(unsigned n=0; n<size; )
+        {
+            Instruction i = Decode(p, n, size, base);
+            if(Test(covered, n) || !i.length || p[n] == 0x00 || !Free(n, i.length)) { ++n; continue; }
+            Take(n, i.length);
+            if(i.target != ~0u) Set(targets, i.target);
+            n += i.length;
+        }
+
+        // Publish. Words that are read meanwhile may mix old and new ones;
+        // the viewer redraws everything once the bank is published.
+        built[bank].store(0, std::memory_order_release);
+        std::atomic<uint_least32_t>* w = &words[std::size_t(bank) * WordsPerBank * 4];
+        for(unsigned l=0; l<WordsPerBank; ++l, w += 4)
+        {
+            // Bytes past the end of a short bank are neither code nor data.
+            uint32_t past = l*32 >= size ? ~0u : size - l*32 >= 32 ? 0 : ~0u << (size - l*32);
+            w[0].store(starts[l],  std::memory_order_relaxed);
+            w[1].store(traced[l],  std::memory_order_relaxed);
+            w[2].store(targets[l], std::memory_order_relaxed);
+            w[3].store(~covered[l] & ~past, std::memory_order_relaxed);
+        }
+        built[bank].store(base, std::memory_order_release);
+        published.fetch_add(1, std::memory_order_release);
+    }
+
+    void Thread()
+    {
+        unsigned seen = 0;
+        std::vector<unsigned> bases;
+        std::unique_lock<std::mutex> l(lock);
+        for(;;)
+        {
+            wake.wait(l, [&]{ return quit || request != seen; });
+            if(quit) return;
+            seen  = request;
+            bases = wanted;
+            l.unlock();
+
+            for(unsigned bank=0; bank<n_banks; ++bank)
+            {
+                if(built[bank].load(std::memory_order_relaxed) == bases[bank]) continue;
+                {
+                    std::lock_guard<std::mutex> g(lock);
+                    if(quit || request != seen) break;
+                }
+                Build(bank, bases[bank]);
+            }
+            l.lock();
+        }
+    }
+
+public:
+    // Indexes the n_rom16k banks that begin at image[origin], as far as the image goes.
+    CodeIndex(const ROMimage& img, FileOffset origin_, unsigned n_rom16k)
+        : image(img), origin(origin_),
+          n_banks(image.size() > origin_ ? std::min<FileOffset>(n_rom16k, (image.size() - origin_ + BankSize-1) / BankSize) : 0),
+          words(new std::atomic<uint_least32_t>[std::size_t(n_banks) * WordsPerBank * 4]()),
+          built(new std::atomic<unsigned>[n_banks]())
+    {
+    }
+    ~CodeIndex()
+    {
+        { std::lock_guard<std::mutex> l(lock);
+          quit = true; }
+        wake.notify_all();
+        if(thread.joinable()) thread.join();
+    }
+    CodeIndex(const CodeIndex&) = delete;
+    void operator=(const CodeIndex&) = delete;
+
+    // Sets the CPU address of each bank ($8000 or $C000); the banks whose
+    // address changed are indexed again. The thread is only created when
+    // this is first called.
+    void Map(const std::vector<unsigned>& bases)
+    {
+        { std::lock_guard<std::mutex> l(lock);
+          wanted = bases;
+          wanted.resize(n_banks, 0x8000);
+          ++request; }
+        if(!thread.joinable())
+            thread = std::thread(&CodeIndex::Thread, this);
+        wake.notify_all();
+    }
+
+    // How many times a bank has been published; changes whenever there is something new to show.
+    std::size_t Published() const { return published.load(std::memory_order_acquire); }
+
+    // Whether the bank of the byte "offset" bytes after the first bank has been indexed.
+    bool Indexed(FileOffset offset) const
+    {
+        return offset / BankSize < n_banks && built[offset / BankSize].load(std::memory_order_acquire);
+    }
+
+    // The words of the 32 bytes that contain the byte "offset" bytes after the first bank.
+    // Returns false if its bank has not been indexed yet.
+    bool Get(FileOffset offset, Words& out) const
+    {
+        if(!Indexed(offset))
+            return false;
+        const std::atomic<uint_least32_t>* w = &words[offset / WordBytes * 4];
+        out = { w[0].load(std::memory_order_relaxed), w[1].load(std::memory_order_relaxed),
+                w[2].load(std::memory_order_relaxed), w[3].load(std::memory_order_relaxed) };
+        return true;
+    }
+};
@@ -0,0 +1,75 @@
+#include <vector>
+#include <algorithm>
+
+/* Glyph span cache.
+ *
+ * Looking up a character through the font's GetIndex() is a virtual call
+ * followed by a binary search, and expanding the bitmap byte into pixels
+ * is a loop of bit tests. Both are done here once:
+ *   - Codepoints below IndexRange are mapped into bitmap offsets at construction.
+ *   - For every foreground/background pair in use, each possible bitmap row
+ *     pattern is expanded into a ready span of Width pixels.
+ * Drawing one row of a glyph is then a table lookup and a short copy.
+ */
+template<unsigned Width, unsigned Height>
+class GlyphCache
+{
+    static constexpr unsigned PatternBits = Width < 8 ? Width : 8;
+    static constexpr unsigned NumPatterns = 1u << PatternBits;
+    static constexpr unsigned IndexRange  = 0x2800; // Covers cp437 and the 0x2660 control pictures
+
+    struct ColorPair
+    {
+        Pixel fg, bg;
+        std::vector<Pixel> spans; // NumPatterns * Width
+    };
+
+    const unsigned char*         bitmap;
+    std::vector<uint_least16_t>  offsets; // codepoint -> offset of glyph in bitmap
+    std::vector<ColorPair>       pairs;
+    unsigned                     last_pair = 0;
+    unsigned (*find_index)(char32_t);
+
+public:
+    typedef const Pixel* Colors;
+
+    template<typename Font>
+    explicit GlyphCache(const Font& font)
+        : bitmap(font.GetBitmap()), offsets(IndexRange),
+          find_index([](char32_t c) -> unsigned { return Font().GetIndex(c); })
+    {
+        for(unsigned c=0; c<IndexRange; ++c)
+            offsets[c] = font.GetIndex(c) * Height;
+    }
+
+    // Returns the span table for the given colors, creating it on first use.
+    Colors GetColors(Pixel fg, Pixel bg)
+    {
+        if(last_pair < pairs.size() && pairs[last_pair].fg == fg && pairs[last_pair].bg == bg)
+            return &pairs[last_pair].spans[0];
+
+        for(last_pair=0; last_pair<pairs.size(); ++last_pair)
+            if(pairs[last_pair].fg == fg && pairs[last_pair].bg == bg)
+                return &pairs[last_pair].spans[0];
+
+        pairs.push_back( { fg, bg, std::vector<Pixel>(NumPatterns * Width) } );
+        Pixel* s = &pairs.back().spans[0];
+        for(unsigned pattern=0; pattern<NumPatterns; ++pattern)
+            for(unsigned x=0; x<Width; ++x)
+                *s++ = (x < PatternBits && (pattern & (NumPatterns >> 1 >> x))) ? fg : bg;
+        return &pairs.back().spans[0];
+    }
+
+    // Returns the Width pixels of the given row of the glyph.
+    const Pixel* GetRow(Colors colors, char32_t c, unsigned row) const
+    {
+        unsigned offset = c < IndexRange ? offsets[c] : find_index(c) * Height;
+        unsigned pattern = bitmap[offset + row] >> (8 - PatternBits);
+        return colors + pattern * Width;
+    }
+
+    void Put(Pixel* buffer, Colors colors, char32_t c, unsigned row) const
+    {
+        std::copy_n(GetRow(colors, c, row), Width, buffer);
+    }
+};
@@ -0,0 +1,172 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+/* Streaming image file writer, for rendering without a window.
+ *
+ * Rows are written out as soon as they are given, so images taller than
+ * memory can be produced. The format is chosen by the file extension:
+ * ".png" writes a PNG, anything else a binary PPM (P6).
+ *
+ * The PNG is written with uncompressed ("stored") deflate blocks, which
+ * needs no zlib; the only checksums needed are the chunk CRCs, which come
+ * from crc32.h, and the Adler-32 of the zlib stream.
+ *
+ * PNG allows at most 2^31-1 rows; so that both formats behave the same,
+ * taller images are refused, and so are empty ones, which PNG cannot have.
+ */
+class ImageFileWriter
+{
+    std::FILE* fp = nullptr;
+    bool       png = false;
+    unsigned   width = 0;
+    FileOffset height = 0, rows_written = 0;
+
+    std::vector<unsigned char> pending; // Filtered PNG scanlines not yet written
+    bool          stream_started = false;
+    uint_fast32_t adler_a = 1, adler_b = 0;
+
+    static void Put32(unsigned char* p, uint_fast32_t v)
+    {
+        p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+    }
+    void Chunk(const char* type, const unsigned char* data, std::size_t length)
+    {
+        unsigned char buf[8];
+        Put32(buf, length);
+        std::memcpy(buf+4, type, 4);
+        std::fwrite(buf, 1, 8, fp);
+        if(length) std::fwrite(data, 1, length, fp);
+
+        crc32_t crc = crc32_calc_upd(crc32_startvalue, (const unsigned char*)type, 4);
+        crc = crc32_calc_upd(crc, data, length);
+        Put32(buf, ~crc & 0xFFFFFFFFu);
+        std::fwrite(buf, 1, 4, fp);
+    }
+    void Adler(const unsigned char* data, std::size_t length)
+    {
+        while(length > 0)
+        {
+            std::size_t n = length < 5552 ? length : 5552; // Largest n that cannot overflow
+            for(std::size_t p=0; p<n; ++p) { adler_a += data[p]; adler_b += adler_a; }
+            adler_a %= 65521; adler_b %= 65521;
+            data += n; length -= n;
+        }
+    }
+    // Writes the pending scanlines as one IDAT chunk of stored deflate blocks.
+    void FlushPNG(bool final)
+    {
+        std::vector<unsigned char> idat;
+        if(!stream_started)
+        {
+            idat.push_back(0x78); idat.push_back(0x01); // zlib header, no compression
+            stream_started = true;
+        }
+
+        std::size_t pos = 0;
+        do {
+            std::size_t n = pending.size() - pos;
+            if(n > 65535) n = 65535;
+            bool last = final && pos + n == pending.size();
+            idat.push_back(last ? 1 : 0);
+            idat.push_back(n & 0xFF);  idat.push_back(n >> 8);
+            idat.push_back(~n & 0xFF); idat.push_back((~n >> 8) & 0xFF);
+            idat.insert(idat.end(), pending.begin() + pos, pending.begin() + pos + n);
+            pos += n;
+        } while(pos < pending.size());
+
+        if(final)
+        {
+            unsigned char buf[4];
+            Put32(buf, (adler_b << 16) | adler_a);
+            idat.insert(idat.end(), buf, buf+4);
+        }
+        Chunk("IDAT", &idat[0], idat.size());
+        pending.clear();
+    }
+
+public:
+    static constexpr FileOffset MaxHeight = 0x7FFFFFFF;
+
+    ~ImageFileWriter() { Close(); }
+
+    // Returns false, with errno set, if the file cannot be created
+    // or the height is 0 or more than MaxHeight.
+    bool Open(const std::string& filename, unsigned w, FileOffset h)
+    {
+        if(h == 0 || h > MaxHeight)
+        {
+            errno = h ? EFBIG : EINVAL;
+            return false;
+        }
+        fp = std::fopen(filename.c_str(), "wb");
+        if(!fp) return false;
+        width  = w;
+        height = h;
+        png    = filename.size() >= 4 && filename.compare(filename.size()-4, 4, ".png") == 0;
+
+        if(png)
+        {
+            static const unsigned char signature[8] = {0x89,'P','N','G','\r','\n',0x1A,'\n'};
+            std::fwrite(signature, 1, 8, fp);
+
+            unsigned char ihdr[13];
+            Put32(ihdr+0, width);
+            Put32(ihdr+4, height);
+            ihdr[8]  = 8; // Bits per sample
+            ihdr[9]  = 2; // RGB
+            ihdr[10] = 0; // Deflate
+            ihdr[11] = 0; // Adaptive filtering
+            ihdr[12] = 0; // Not interlaced
+            Chunk("IHDR", ihdr, sizeof(ihdr));
+        }
+        else
+            std::fprintf(fp, "P6\n%u %u\n255\n", width, unsigned(height));
+        return true;
+    }
+
+    // Writes the next row, given as "width" ARGB pixels.
+    void WriteRow(const uint32_t* pixels)
+    {
+        std::vector<unsigned char> row;
+        row.reserve(1 + width*3);
+        if(png) row.push_back(0); // Filter type: none
+        for(unsigned x=0; x<width; ++x)
+        {
+            row.push_back(pixels[x] >> 16);
+            row.push_back(pixels[x] >> 8);
+            row.push_back(pixels[x]);
+        }
+
+        if(!png)
+            std::fwrite(&row[0], 1, row.size(), fp);
+        else
+        {
+            Adler(&row[0], row.size());
+            pending.insert(pending.end(), row.begin(), row.end());
+            if(pending.size() >= 262144)
+                FlushPNG(false);
+        }
+        ++rows_written;
+    }
+
+    // Returns false, with errno set, if there was a write error, or if fewer
+    // or more rows were written than the header says (EIO for both).
+    bool Close()
+    {
+        if(!fp) return true;
+        if(png)
+        {
+            FlushPNG(true);
+            Chunk("IEND", nullptr, 0);
+        }
+        bool written = !std::ferror(fp) && rows_written == height;
+        bool closed  = std::fclose(fp) == 0;
+        fp = nullptr;
+        if(!written) errno = EIO;
+        return written && closed;
+    }
+};
@@ -0,0 +1,128 @@
+#include <vector>
+#include <cstdint>
+
+// Color classes of bytes in the text view
+enum TextClass { TextPlain, TextAlnum, TextControl, TextHigh };
+
+// The characters of the text view
+static const unsigned cp437[256] =
+{
+  0x0000,0x0001,0x0002,0x0003,0x0004,0x0005,0x0006,0x0007,0x0008,0x0009,0x000a,0x000b,0x000c,0x000d,0x000e,0x000f,0x0010,0x0011,0x0012,0x0013,0x0014,0x0015,0x0016,0x0017,0x0018,0x0019,0x001a,0x001b,0x001c,0x001d,0x001e,0x001f,0x0020,0x0021,0x0022,0x0023,0x0024,0x0025,0x0026,0x0027,0x0028,0x0029,0x002a,0x002b,0x002c,0x002d,0x002e,0x002f,0x0030,0x0031,0x0032,0x0033,0x0034,0x0035,0x0036,0x0037,0x0038,0x0039,0x003a,0x003b,0x003c,0x003d,0x003e,0x003f,0x0040,0x0041,0x0042,0x0043,0x0044,0x0045,0x0046,0x0047,0x0048,0x0049,0x004a,0x004b,0x004c,0x004d,0x004e,0x004f,0x0050,0x0051,0x0052,0x0053,0x0054,0x0055,0x0056,0x0057,0x0058,0x0059,0x005a,0x005b,0x005c,0x005d,0x005e,0x005f,0x0060,0x0061,0x0062,0x0063,0x0064,0x0065,0x0066,0x0067,0x0068,0x0069,0x006a,0x006b,0x006c,0x006d,0x006e,0x006f,0x0070,0x0071,0x0072,0x0073,0x0074,0x0075,0x0076,0x0077,0x0078,0x0079,0x007a,0x007b,0x007c,0x007d,0x007e,0x007f,0x00c7,0x00fc,0x00e9,0x00e2,0x00e4,0x00e0,0x00e5,0x00e7,0x00ea,0x00eb,0x00e8,0x00ef,0x00ee,0x00ec,0x00c4,0x00c5,0x00c9,0x00e6,0x00c6,0x00f4,0x00f6,0x00f2,0x00fb,0x00f9,0x00ff,0x00d6,0x00dc,0x00a2,0x00a3,0x00a5,0x20a7,0x0192,0x00e1,0x00ed,0x00f3,0x00fa,0x00f1,0x00d1,0x00aa,0x00ba,0x00bf,0x2310,0x00ac,0x00bd,0x00bc,0x00a1,0x00ab,0x00bb,0x2591,0x2592,0x2593,0x2502,0x2524,0x2561,0x2562,0x2556,0x2555,0x2563,0x2551,0x2557,0x255d,0x255c,0x255b,0x2510,0x2514,0x2534,0x252c,0x251c,0x2500,0x253c,0x255e,0x255f,0x255a,0x2554,0x2569,0x2566,0x2560,0x2550,0x256c,0x2567,0x2568,0x2564,0x2565,0x2559,0x2558,0x2552,0x2553,0x256b,0x256a,0x2518,0x250c,0x2588,0x2584,0x258c,0x2590,0x2580,0x03b1,0x00df,0x0393,0x03c0,0x03a3,0x03c3,0x00b5,0x03c4,0x03a6,0x0398,0x03a9,0x03b4,0x221e,0x03c6,0x03b5,0x2229,0x2261,0x00b1,0x2265,0x2264,0x2320,0x2321,0x00f7,0x2248,0x00b0,0x2219,0x00b7,0x221a,0x207f,0x00b2,0x25a0,0x00a0
+};
+
+/* Text layout of dump lines.
+ *
+ * What a byte looks like in the text view (its character and color class)
+ * depends only on its value and on the transliteration. That is worked out
+ * for all 256 values whenever the transliteration changes, and applied to
+ * a whole line at a time: the line's bytes, characters and classes are kept
+ * in a small cache, so that the pixel rows of a line, in both the hex and the
+ * text view, share one pass over the bytes.
+ *
+ * Lines are cached direct-mapped by their line number. Fill() and Validate()
+ * may only be called while nothing is being rendered; Find() can be called
+ * from any thread.
+ */
+template<unsigned Chars>
+class LayoutCache
+{
+public:
+    struct Line
+    {
+        FileOffset     offset = ~FileOffset(0);
+        unsigned       width  = 0;        // Bytes on the line
+        unsigned char  bytes[Chars];
+        uint_least16_t glyph[Chars];      // Character in the text view
+        unsigned char  cls[Chars];        // TextClass
+    };
+
+private:
+    static constexpr unsigned Slots = 256; // More than the lines of any batch of rows
+
+    std::vector<Line> lines;
+    unsigned char     transliterate = 0, transliterate2 = 0;
+    uint_least16_t    glyph_of[256];
+    unsigned char     class_of[256];
+
+public:
+    LayoutCache() : lines(Slots)
+    {
+        Classify();
+    }
+
+    // The character and color class of a byte under the given transliteration.
+    static void Classify(unsigned char byte, unsigned char t, unsigned char t2,
+                         uint_least16_t& glyph, unsigned char& cls)
+    {
+        unsigned c = cp437[TextViewChar(byte, t, t2)];
+
+        cls = TextPlain;
+        if( (c >= 'A' && c <= 'Z')
+         || (c >= 'a' && c <= 'z')
+         || (c >= '0' && c <= '9') )
+            cls = TextAlnum;
+        if(c < 0x20)
+        {
+            if(c == 0)
+                c = '.';
+            else
+                c = 0x2660 + (c&0x1F);
+            cls = TextControl;
+        }
+        else if(c >= 0x80)
+        {
+            //c = 0x100+(c&0x7F);
+            cls = TextHigh;
+        }
+        glyph = c;
+    }
+    void Classify()
+    {
+        for(unsigned b=0; b<256; ++b)
+            Classify(b, transliterate, transliterate2, glyph_of[b], class_of[b]);
+    }
+
+    // Drops everything if the transliteration has changed.
+    void Validate(unsigned char t, unsigned char t2)
+    {
+        if(t == transliterate && t2 == transliterate2) return;
+        transliterate  = t;
+        transliterate2 = t2;
+        Classify();
+        for(auto& l: lines) l.offset = ~FileOffset(0);
+    }
+
+    // Lays out the "width" bytes at data+offset, as they appear with the given transliteration.
+    void Build(Line& l, const unsigned char* data, FileOffset offset, unsigned width,
+               unsigned char t, unsigned char t2) const
+    {
+        l.offset = offset;
+        l.width  = width;
+        const bool known = t == transliterate && t2 == transliterate2;
+        for(unsigned p=0; p<width; ++p)
+        {
+            unsigned char b = data[offset + p];
+            l.bytes[p] = b;
+            if(known) { l.glyph[p] = glyph_of[b]; l.cls[p] = class_of[b]; }
+            else      Classify(b, t, t2, l.glyph[p], l.cls[p]);
+        }
+    }
+
+    // Makes sure that the line is in the cache.
+    void Fill(FileOffset line, const unsigned char* data, FileOffset offset, unsigned width)
+    {
+        Line& l = lines[line % Slots];
+        if(l.offset != offset || l.width != width)
+            Build(l, data, offset, width, transliterate, transliterate2);
+    }
+
+    // The line, if it is in the cache and laid out with the given transliteration.
+    const Line* Find(FileOffset line, FileOffset offset, unsigned width,
+                     unsigned char t, unsigned char t2) const
+    {
+        const Line& l = lines[line % Slots];
+        if(l.offset != offset || l.width != width || t != transliterate || t2 != transliterate2)
+            return nullptr;
+        return &l;
+    }
+};
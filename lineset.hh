@@ -0,0 +1,86 @@
+#include <vector>
+#include <cstdint>
+
+/* A set of scanline numbers, packed 64 to a word.
+ * Searches skip clear words entirely and use count-trailing-zeros
+ * within a word, so finding the next dirty line or walking over
+ * the dirty spans costs a few instructions per 64 lines.
+ */
+class LineSet
+{
+    std::vector<uint_least64_t> words;
+    unsigned                    size = 0;
+
+    static unsigned ctz(uint_least64_t w) { return __builtin_ctzll(w); }
+
+public:
+    void Resize(unsigned n)
+    {
+        size = n;
+        words.resize((n + 63) / 64, 0);
+        if(n % 64) words.back() &= (uint_least64_t(1) << (n % 64)) - 1;
+    }
+    unsigned Size() const { return size; }
+
+    bool Test(unsigned y) const { return words[y/64] >> (y%64) & 1; }
+    void Set(unsigned y)        { words[y/64] |=  (uint_least64_t(1) << (y%64)); }
+    void Reset(unsigned y)      { words[y/64] &= ~(uint_least64_t(1) << (y%64)); }
+    void Assign(unsigned y, bool v) { if(v) Set(y); else Reset(y); }
+
+    // Adds lines begin..end-1
+    void SetRange(unsigned begin, unsigned end)
+    {
+        for(; begin < end && begin % 64; ++begin) Set(begin);
+        for(; begin + 64 <= end; begin += 64) words[begin/64] = ~uint_least64_t(0);
+        for(; begin < end; ++begin) Set(begin);
+    }
+    void Clear()
+    {
+        for(auto& w: words) w = 0;
+    }
+    bool Empty() const
+    {
+        for(auto w: words) if(w) return false;
+        return true;
+    }
+
+    // Returns the first member that is >= y, or Size() if there is none.
+    unsigned FindNext(unsigned y) const
+    {
+        if(y >= size) return size;
+        unsigned n = y / 64;
+        uint_least64_t w = words[n] & (~uint_least64_t(0) << (y%64));
+        while(!w)
+        {
+            if(++n >= words.size()) return size;
+            w = words[n];
+        }
+        return n*64 + ctz(w);
+    }
+    // Returns the first non-member that is >= y, or Size() if there is none.
+    unsigned FindNextClear(unsigned y) const
+    {
+        if(y >= size) return size;
+        unsigned n = y / 64;
+        uint_least64_t w = ~words[n] & (~uint_least64_t(0) << (y%64));
+        while(!w)
+        {
+            if(++n >= words.size()) return size;
+            w = ~words[n];
+        }
+        unsigned r = n*64 + ctz(w);
+        return r < size ? r : size;
+    }
+
+    // Calls f(begin, end) for each run of consecutive members.
+    template<typename F>
+    void ForEachSpan(F&& f) const
+    {
+        for(unsigned y = FindNext(0); y < size; )
+        {
+            unsigned end = FindNextClear(y);
+            f(y, end);
+            y = FindNext(end);
+        }
+    }
+};
@@ -104,7 +104,8 @@ static unsigned char GetMarioBit(
     unsigned pose,          // frame number
     unsigned x, unsigned y, // coordinates for dithering 
     signed int MarioOffset, // -6..+16
-    unsigned VidCellHeight = 16)
+    unsigned VidCellHeight = 16,
+    unsigned Timer = MarioTimer) // for the dithering phase
 {
     const unsigned NumMarioPoses = VidCellHeight >= 29 ? 3 : 2;
 
@@ -123,7 +124,7 @@ static unsigned char GetMarioBit(
 
     static const unsigned char dither4x4[16] =
         {0,12,3,15, 8,4,11,7, 2,14,1,13, 10,6,9,5};
-    const unsigned char* dithline = dither4x4 + (((y+MarioTimer) & 3u) * 4u);
+    const unsigned char* dithline = dither4x4 + (((y+Timer) & 3u) * 4u);
 
     unsigned char dithval = dithline[ x&3 ];
     switch(*data++ / 3)
@@ -148,3 +149,25 @@ static unsigned char GetMarioBit(
             return 0;
     }
 }
+
+/* GetMarioBit() for the 16 pixel tall poses, precomputed for each
+ * dithering phase (Timer & 3) and horizontal position modulo 4,
+ * so that drawing Mario is a table lookup per pixel.
+ * Indexed by [pose][phase][x & 3][y][MarioOffset - MinOffset].
+ */
+struct MarioSprite
+{
+    static constexpr int MinOffset = -7, MaxOffset = 23;
+
+    unsigned char bits[2][4][4][16][MaxOffset - MinOffset + 1];
+
+    MarioSprite()
+    {
+        for(unsigned pose=0; pose<2; ++pose)
+            for(unsigned phase=0; phase<4; ++phase)
+                for(unsigned xmod=0; xmod<4; ++xmod)
+                    for(unsigned y=0; y<16; ++y)
+                        for(int o=MinOffset; o<=MaxOffset; ++o)
+                            bits[pose][phase][xmod][y][o - MinOffset] = GetMarioBit(pose, xmod + o, y, o, 16, phase);
+    }
+};
@@ -0,0 +1,80 @@
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define PALETTE_HAVE_SIMD 1
+# include <immintrin.h>
+#endif
+
+// A pixel of the framebuffer: an index into the palette
+typedef unsigned char Pixel;
+
+/* The colors of the framebuffer.
+ *
+ * Everything is rendered in palette indexes, one byte per pixel, and
+ * expanded into ARGB only for the rows that are uploaded to the screen.
+ * Colors that never change are shared: asking twice for the same color
+ * gives the same index. Colors that can change are given an entry of
+ * their own with Add(); changing one recolors the screen at the next
+ * upload, without anything being rendered again.
+ *
+ * The AVX2 expansion widens eight indexes at a time and fetches their
+ * colors with a gather; the table is padded to 256 entries, so every
+ * byte is a valid index.
+ */
+class Palette
+{
+    alignas(32) uint32_t colors[256] = {};
+    bool                 fixed[256] = {};
+    unsigned             used = 0;
+
+    static void ExpandScalar(const uint32_t* table, uint32_t* out, const Pixel* in, std::size_t n)
+    {
+        for(std::size_t x=0; x<n; ++x) out[x] = table[in[x]];
+    }
+
+#ifdef PALETTE_HAVE_SIMD
+    __attribute__((target("avx2")))
+    static void ExpandAVX2(const uint32_t* table, uint32_t* out, const Pixel* in, std::size_t n)
+    {
+        std::size_t x = 0;
+        for(; x+8 <= n; x += 8)
+        {
+            __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + x)));
+            _mm256_storeu_si256((__m256i*)(out + x), _mm256_i32gather_epi32((const int*)table, idx, 4));
+        }
+        ExpandScalar(table, out + x, in + x, n - x);
+    }
+#endif
+
+public:
+    // The index of a fixed color; it is added if it is new.
+    Pixel Index(uint32_t color)
+    {
+        for(unsigned p=0; p<used; ++p)
+            if(fixed[p] && colors[p] == color) return p;
+        Pixel p = Add(color);
+        fixed[p] = true;
+        return p;
+    }
+    // A new entry of its own, for a color that may be changed later.
+    // When all 256 are in use, the last one is shared.
+    Pixel Add(uint32_t color)
+    {
+        if(used < 256) ++used;
+        colors[used-1] = color;
+        return used-1;
+    }
+    void     Set(Pixel p, uint32_t color) { colors[p] = color; }
+    uint32_t operator[] (Pixel p) const   { return colors[p]; }
+
+    // Converts n pixels into their colors.
+    void Expand(uint32_t* out, const Pixel* in, std::size_t n) const
+    {
+    #ifdef PALETTE_HAVE_SIMD
+        static const bool have_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+        if(have_avx2) { ExpandAVX2(colors, out, in, n); return; }
+    #endif
+        ExpandScalar(colors, out, in, n);
+    }
+};
@@ -0,0 +1,176 @@
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+/* Frame timing instrumentation.
+ *
+ * The time of each frame is split into phases: rendering lines, checksumming
+ * them, uploading rows into the texture, presenting, and waiting for input.
+ * Render and checksum times are summed over all worker threads, so together
+ * they can exceed the wall time of the frame.
+ *
+ * Nothing is measured unless "enabled" is set. The averages of the last
+ * half second are available through Summary(), and if a trace file was
+ * opened, every frame is also recorded in Chrome's trace event format
+ * (chrome://tracing, Perfetto) and written out when the profiler is destroyed.
+ */
+class FrameProfiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Phase   { Render, Checksum, Upload, Present, Idle, NumPhases };
+    enum Counter { LinesRendered, LinesUnchanged, BytesUploaded, NumCounters };
+
+    bool enabled = false;
+
+private:
+    static constexpr std::size_t MaxTraceEvents = 1u << 20;
+
+    static const char* PhaseName(unsigned p)
+    {
+        static const char* const names[NumPhases] = { "render", "checksum", "upload", "present", "idle" };
+        return names[p];
+    }
+
+    std::atomic<uint_least64_t> phase_ns[NumPhases] {};  // This frame so far
+    uint_least64_t              counters[NumCounters] {};
+
+    // Sums over the current averaging window, and the averages of the previous one.
+    uint_least64_t    window_ns[NumPhases] {}, window_counters[NumCounters] {};
+    unsigned          window_frames = 0;
+    Clock::time_point window_begin = Clock::now();
+    double            avg_ms[NumPhases] {}, avg_counters[NumCounters] {};
+
+    struct TraceEvent
+    {
+        const char*    name;
+        char           type;     // 'X' = span, 'C' = counters of one frame
+        uint_least64_t ts, dur;  // Microseconds
+        uint_least64_t values[NumPhases + NumCounters];
+    };
+    std::FILE*              trace = nullptr;
+    std::vector<TraceEvent> events;
+    Clock::time_point       trace_begin = Clock::now();
+
+    uint_least64_t Micros(Clock::time_point t) const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - trace_begin).count();
+    }
+
+public:
+    ~FrameProfiler() { CloseTrace(); }
+
+    Clock::time_point Now() const { return enabled ? Clock::now() : Clock::time_point(); }
+
+    // Adds the time from begin to end into a phase. Can be called from any thread.
+    void Add(Phase p, Clock::time_point begin, Clock::time_point end)
+    {
+        if(enabled)
+            phase_ns[p].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(),
+                                  std::memory_order_relaxed);
+    }
+    void Count(Counter c, uint_least64_t n)
+    {
+        if(enabled) counters[c] += n;
+    }
+
+    // Adds the time from begin until now into a phase, and records it as
+    // a span in the trace. Main thread only.
+    void Span(Phase p, Clock::time_point begin)
+    {
+        Span(PhaseName(p), begin);
+        Add(p, begin, Now());
+    }
+    void Span(const char* name, Clock::time_point begin)
+    {
+        if(!enabled || !trace || events.size() >= MaxTraceEvents) return;
+        uint_least64_t ts = Micros(begin);
+        events.push_back({ name, 'X', ts, Micros(Clock::now()) - ts, {} });
+    }
+
+    // Closes the current frame. Returns true when new averages are available.
+    bool EndFrame()
+    {
+        if(!enabled) return false;
+
+        uint_least64_t ns[NumPhases];
+        for(unsigned p=0; p<NumPhases; ++p)
+            window_ns[p] += ns[p] = phase_ns[p].exchange(0, std::memory_order_relaxed);
+
+        if(trace && events.size() < MaxTraceEvents)
+        {
+            TraceEvent e { "frame", 'C', Micros(Clock::now()), 0, {} };
+            for(unsigned p=0; p<NumPhases; ++p)   e.values[p]             = ns[p] / 1000;
+            for(unsigned c=0; c<NumCounters; ++c) e.values[NumPhases + c] = counters[c];
+            events.push_back(e);
+        }
+
+        for(unsigned c=0; c<NumCounters; ++c)
+        {
+            window_counters[c] += counters[c];
+            counters[c] = 0;
+        }
+        ++window_frames;
+
+        auto now = Clock::now();
+        if(now - window_begin < std::chrono::milliseconds(500)) return false;
+
+        for(unsigned p=0; p<NumPhases; ++p)   { avg_ms[p] = window_ns[p] / 1e6 / window_frames; window_ns[p] = 0; }
+        for(unsigned c=0; c<NumCounters; ++c) { avg_counters[c] = double(window_counters[c]) / window_frames; window_counters[c] = 0; }
+        window_frames = 0;
+        window_begin  = now;
+        return true;
+    }
+
+    // The per-frame averages, in a form that fits in the status bar.
+    std::string Summary() const
+    {
+        char Buf[160];
+        std::sprintf(Buf, "ms/frame: rend %.2f crc %.2f upl %.2f pres %.2f idle %.1f; lines %.0f same %.0f; %.0fkB",
+            avg_ms[Render], avg_ms[Checksum], avg_ms[Upload], avg_ms[Present], avg_ms[Idle],
+            avg_counters[LinesRendered], avg_counters[LinesUnchanged], avg_counters[BytesUploaded] / 1024);
+        return Buf;
+    }
+
+    bool Tracing() const { return trace != nullptr; }
+
+    // Returns false if the file cannot be created.
+    bool OpenTrace(const char* filename)
+    {
+        trace = std::fopen(filename, "w");
+        trace_begin = Clock::now();
+        return trace != nullptr;
+    }
+    void CloseTrace()
+    {
+        if(!trace) return;
+        std::fprintf(trace, "{\"traceEvents\":[\n");
+        for(std::size_t n=0; n<events.size(); ++n)
+        {
+            const TraceEvent& e = events[n];
+            const char* sep = n+1 < events.size() ? "," : "";
+            if(e.type == 'X')
+                std::fprintf(trace, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%llu,\"dur\":%llu}%s\n",
+                    e.name, (unsigned long long)e.ts, (unsigned long long)e.dur, sep);
+            else
+            {
+                std::fprintf(trace, "{\"name\":\"phase us\",\"ph\":\"C\",\"pid\":1,\"ts\":%llu,\"args\":{", (unsigned long long)e.ts);
+                for(unsigned p=0; p<NumPhases; ++p)
+                    std::fprintf(trace, "%s\"%s\":%llu", p ? "," : "", PhaseName(p), (unsigned long long)e.values[p]);
+                std::fprintf(trace, "}},\n{\"name\":\"lines\",\"ph\":\"C\",\"pid\":1,\"ts\":%llu,\"args\":{\"rendered\":%llu,\"unchanged\":%llu}},\n",
+                    (unsigned long long)e.ts,
+                    (unsigned long long)e.values[NumPhases + LinesRendered],
+                    (unsigned long long)e.values[NumPhases + LinesUnchanged]);
+                std::fprintf(trace, "{\"name\":\"bytes uploaded\",\"ph\":\"C\",\"pid\":1,\"ts\":%llu,\"args\":{\"bytes\":%llu}}%s\n",
+                    (unsigned long long)e.ts, (unsigned long long)e.values[NumPhases + BytesUploaded], sep);
+            }
+        }
+        std::fprintf(trace, "]}\n");
+        std::fclose(trace);
+        trace = nullptr;
+    }
+};
@@ -0,0 +1,103 @@
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Byte offsets into the image are 64-bit, so that dumps larger than 4 GB work.
+typedef std::uint64_t FileOffset;
+
+/* Read-only view of the file being examined.
+ *
+ * Regular files are memory-mapped rather than read, so opening even
+ * a multi-gigabyte dump is immediate, and only the pages that are
+ * actually looked at become resident. Anything that cannot be mapped
+ * (pipes, empty files) and images constructed in memory are kept
+ * in an owned buffer instead.
+ */
+class ROMimage
+{
+    const unsigned char*       data    = nullptr;
+    std::size_t                length  = 0;
+    void*                      mapping = nullptr;
+    std::vector<unsigned char> owned;
+
+public:
+    ROMimage() = default;
+    explicit ROMimage(std::vector<unsigned char> bytes) : owned(std::move(bytes))
+    {
+        data   = owned.data();
+        length = owned.size();
+    }
+    ~ROMimage()
+    {
+        if(mapping) munmap(mapping, length);
+    }
+    ROMimage(ROMimage&& b) : data(b.data), length(b.length), mapping(b.mapping), owned(std::move(b.owned))
+    {
+        if(!mapping) data = owned.data();
+        b.mapping = nullptr;
+        b.data    = nullptr;
+        b.length  = 0;
+    }
+    ROMimage(const ROMimage&) = delete;
+    void operator=(const ROMimage&) = delete;
+
+    // Returns false and sets errno on failure.
+    bool Open(const char* filename)
+    {
+        int fd = open(filename, O_RDONLY);
+        if(fd < 0) return false;
+
+        struct stat st;
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if(p != MAP_FAILED)
+            {
+                close(fd);
+                mapping = p;
+                data    = (const unsigned char*)p;
+                length  = st.st_size;
+                // The viewer mostly jumps around; avoid big readaheads by default.
+                AdviseRandom(0, length);
+                return true;
+            }
+        }
+
+        // Fall back into reading the whole thing.
+        unsigned char buf[65536];
+        for(ssize_t r; (r = read(fd, buf, sizeof(buf))) != 0; )
+        {
+            if(r < 0) { close(fd); return false; }
+            owned.insert(owned.end(), buf, buf+r);
+        }
+        close(fd);
+        data   = owned.data();
+        length = owned.size();
+        return true;
+    }
+
+    std::size_t size() const { return length; }
+    const unsigned char& operator[] (FileOffset n) const { return data[n]; }
+
+    // Access pattern hints. These only matter for mapped files.
+    void AdviseRandom(FileOffset begin, FileOffset n) const     { Advise(begin, n, MADV_RANDOM); }
+    void AdviseSequential(FileOffset begin, FileOffset n) const { Advise(begin, n, MADV_SEQUENTIAL); }
+    void Prefetch(FileOffset begin, FileOffset n) const         { Advise(begin, n, MADV_WILLNEED); }
+
+private:
+    void Advise(FileOffset begin, FileOffset n, int advice) const
+    {
+        if(!mapping || begin >= length) return;
+        if(n > length - begin) n = length - begin;
+
+        // madvise() wants a page-aligned address.
+        const FileOffset page = sysconf(_SC_PAGESIZE);
+        FileOffset skew = begin % page;
+        madvise((char*)mapping + (begin - skew), n + skew, advice);
+    }
+};
@@ -0,0 +1,89 @@
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+
+/* Rendered rows of the dump, kept for later, least recently used first out.
+ *
+ * Rows are identified by their pixel row in the whole dump, i.e. by the
+ * line's byte offset and the pixel row within it. Everything else that
+ * affects how they look (the transliteration, the tile size, the highlighted
+ * match) is the "settings" key; when it changes, the whole cache is dropped.
+ *
+ * Not thread-safe: rows are looked up and allocated from one thread, but
+ * the buffers returned by Insert() can be filled in by any thread, as long
+ * as nothing else is looked up or inserted meanwhile.
+ */
+class RowCache
+{
+public:
+    typedef std::vector<FileOffset> Settings;
+
+private:
+    typedef std::list<std::pair<FileOffset,unsigned>> List; // Row and slot, most recently used first
+
+    unsigned                   width, capacity;
+    std::vector<Pixel>         pixels;
+    List                       lru;
+    std::unordered_map<FileOffset, List::iterator> rows;
+    Settings                   settings;
+
+public:
+    RowCache(unsigned width_, unsigned capacity_)
+        : width(width_), capacity(capacity_), pixels(std::size_t(width_) * capacity_)
+    {
+        rows.reserve(capacity);
+    }
+
+    // Drops everything if the settings differ from those of the cached rows.
+    // Returns true if it did.
+    bool Validate(const Settings& s)
+    {
+        if(s == settings) return false;
+        Clear();
+        settings = s;
+        return true;
+    }
+    void Clear()
+    {
+        lru.clear();
+        rows.clear();
+    }
+
+    bool Contains(FileOffset row) const { return rows.count(row) != 0; }
+
+    // Returns the pixels of the row, or nullptr. The row becomes the most recently used.
+    const Pixel* Find(FileOffset row)
+    {
+        auto i = rows.find(row);
+        if(i == rows.end()) return nullptr;
+        lru.splice(lru.begin(), lru, i->second);
+        return &pixels[std::size_t(i->second->second) * width];
+    }
+
+    // Makes room for the row, and returns the buffer that its pixels go into.
+    Pixel* Insert(FileOffset row)
+    {
+        unsigned slot;
+        auto i = rows.find(row);
+        if(i != rows.end())
+        {
+            lru.splice(lru.begin(), lru, i->second);
+            slot = i->second->second;
+        }
+        else
+        {
+            if(lru.size() < capacity)
+                slot = lru.size();
+            else
+            {
+                slot = lru.back().second;
+                rows.erase(lru.back().first);
+                lru.pop_back();
+            }
+            lru.emplace_front(row, slot);
+            rows.emplace(row, lru.begin());
+        }
+        return &pixels[std::size_t(slot) * width];
+    }
+};
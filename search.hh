@@ -0,0 +1,303 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define SEARCH_HAVE_SIMD 1
+# include <emmintrin.h>
+#endif
+
+/* A search pattern: byte p of a match is any b for which
+ * (b & mask[p]) == value[p]. A mask of 0x0F or 0xF0 is a byte
+ * with one wildcard nibble, and a mask of 0 matches anything.
+ */
+struct SearchPattern
+{
+    std::vector<unsigned char> value, mask;
+
+    std::size_t size() const { return value.size(); }
+    void Add(unsigned char v, unsigned char m) { value.push_back(v & m); mask.push_back(m); }
+};
+
+// Parses hex bytes such as "A9 0? 8D", where '?' is a wildcard nibble.
+// Spaces are ignored. Returns false if the pattern is empty or malformed.
+static bool ParseHexPattern(const std::string& s, SearchPattern& pat)
+{
+    pat = SearchPattern{};
+    unsigned value = 0, mask = 0, nibbles = 0;
+    for(char c: s)
+    {
+        unsigned v;
+        if(c == ' ' || c == ',') continue;
+        else if(c >= '0' && c <= '9') v = c - '0';
+        else if(c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else if(c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if(c == '?') v = 0x10;
+        else return false;
+
+        value = (value << 4) | (v & 0xF);
+        mask  = (mask  << 4) | (v == 0x10 ? 0 : 0xF);
+        if(++nibbles % 2 == 0) pat.Add(value, mask);
+    }
+    return nibbles > 0 && nibbles % 2 == 0;
+}
+
+// The character that the text view shows for a byte: the byte is offset by
+// transliterate, and if that lands transliterate2 below a lowercase letter,
+// it is further offset by transliterate2.
+static inline unsigned TextViewChar(unsigned char byte, unsigned char transliterate, unsigned char transliterate2)
+{
+    unsigned c = (byte + transliterate) & 0xFF;
+    if(c+transliterate2 >= 'a' && c+transliterate2 <= 'z') c += transliterate2;
+    return c;
+}
+
+// Makes a pattern that finds the text the way it appears in the text view,
+// i.e. with the same transliteration applied.
+static SearchPattern MakeTextPattern(const std::string& s, unsigned char transliterate, unsigned char transliterate2)
+{
+    SearchPattern pat;
+    for(unsigned char c: s)
+        pat.Add(c - transliterate - ((c >= 'a' && c <= 'z') ? transliterate2 : 0), 0xFF);
+    return pat;
+}
+
+/* Finds a SearchPattern in memory.
+ *
+ * Short patterns, and patterns with many wildcards, are found with an SSE2
+ * prefilter that compares 16 candidate positions at a time against two fixed
+ * bytes of the pattern (the first and the last one that have no wildcards);
+ * only the positions where both agree are compared in full.
+ * Long patterns skip ahead with Boyer-Moore-Horspool instead, which
+ * examines fewer than one byte in 16 when the pattern is long enough.
+ */
+class PatternSearcher
+{
+    SearchPattern pat;
+    unsigned      shift[256];        // Horspool shift for the byte under the pattern's last position
+    unsigned      anchor1 = ~0u, anchor2 = ~0u; // Positions of fixed bytes, if any
+    bool          exact = true;      // No wildcards
+    bool          horspool = false;
+
+    bool Matches(const unsigned char* p) const
+    {
+        if(exact) return std::memcmp(p, &pat.value[0], pat.size()) == 0;
+        for(std::size_t i=0; i<pat.size(); ++i)
+            if((p[i] & pat.mask[i]) != pat.value[i])
+                return false;
+        return true;
+    }
+
+public:
+    static constexpr FileOffset NotFound = ~FileOffset(0);
+
+    explicit PatternSearcher(SearchPattern p) : pat(std::move(p))
+    {
+        const unsigned m = pat.size();
+        for(unsigned i=0; i<m; ++i)
+        {
+            if(pat.mask[i] != 0xFF) { exact = false; continue; }
+            if(anchor1 == ~0u) anchor1 = i;
+            anchor2 = i;
+        }
+
+        // Horspool: the shift for byte b is the distance from the last
+        // position that b could match (other than the final one) to the end.
+        unsigned long total = 0;
+        for(unsigned b=0; b<256; ++b)
+        {
+            shift[b] = m;
+            for(unsigned i=0; i+1 < m; ++i)
+                if((b & pat.mask[i]) == pat.value[i])
+                    shift[b] = m-1-i;
+            total += shift[b];
+        }
+        horspool = total / 256 > 32;
+    }
+
+    std::size_t size() const { return pat.size(); }
+
+    // Returns the first position p, begin <= p, where the pattern
+    // fits entirely before "end", or NotFound.
+    FileOffset FindFirst(const unsigned char* data, FileOffset begin, FileOffset end) const
+    {
+        const unsigned m = pat.size();
+        if(m == 0 || end < begin || end - begin < m) return NotFound;
+        const FileOffset last = end - m; // Last possible match
+
+        if(horspool)
+        {
+            for(FileOffset p = begin; p <= last; p += shift[data[p + m-1]])
+                if(Matches(data + p))
+                    return p;
+            return NotFound;
+        }
+
+        FileOffset p = begin;
+    #ifdef SEARCH_HAVE_SIMD
+        if(anchor1 != ~0u)
+        {
+            const __m128i a1 = _mm_set1_epi8(pat.value[anchor1]);
+            const __m128i a2 = _mm_set1_epi8(pat.value[anchor2]);
+            for(; p <= last && last - p >= 15; p += 16)
+            {
+                __m128i b1 = _mm_loadu_si128((const __m128i*)(data + p + anchor1));
+                __m128i b2 = _mm_loadu_si128((const __m128i*)(data + p + anchor2));
+                unsigned bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(b1, a1), _mm_cmpeq_epi8(b2, a2)));
+                for(; bits; bits &= bits-1)
+                {
+                    FileOffset q = p + __builtin_ctz(bits);
+                    if(Matches(data + q)) return q;
+                }
+            }
+        }
+    #endif
+        for(; p <= last; ++p)
+            if(Matches(data + p))
+                return p;
+        return NotFound;
+    }
+
+    // Returns the last position p, begin <= p, where the pattern
+    // fits entirely before "end", or NotFound.
+    FileOffset FindLast(const unsigned char* data, FileOffset begin, FileOffset end) const
+    {
+        const unsigned m = pat.size();
+        if(m == 0 || end < begin || end - begin < m) return NotFound;
+
+        // Search forward within blocks, going backward one block at a time.
+        const FileOffset Block = 65536;
+        for(FileOffset stop = end - m + 1; stop > begin; )
+        {
+            FileOffset start = stop - begin > Block ? stop - Block : begin;
+            FileOffset found = NotFound;
+            for(FileOffset p = FindFirst(data, start, stop + m-1); p != NotFound; p = FindFirst(data, p+1, stop + m-1))
+                found = p;
+            if(found != NotFound) return found;
+            stop = start;
+        }
+        return NotFound;
+    }
+};
+
+/* Relative search: finds a word in an unknown text encoding.
+ *
+ * Only the differences between the letters of the word are looked for,
+ * so "CAT" matches any bytes x, x-2, x+17. Uppercase letters and lowercase
+ * letters are compared separately, as a game can have its lowercase letters
+ * anywhere relative to the uppercase ones (this is what transliterate2
+ * models); other characters are wildcards.
+ *
+ * For a match, Solve() gives the transliterate and transliterate2 that make
+ * the text view show the word. The scan is the same as in PatternSearcher:
+ * 16 positions at a time, one SSE2 compare per letter.
+ */
+class RelativeSearcher
+{
+    struct Constraint { unsigned char pos, base, diff; }; // data[pos] - data[base] == diff
+    std::vector<Constraint> constraints;
+    std::string   word;
+    int           first_upper = -1, first_lower = -1;
+    unsigned char default_transliterate2;
+
+    bool Matches(const unsigned char* p) const
+    {
+        for(const auto& c: constraints)
+            if(((p[c.pos] - p[c.base]) & 0xFF) != c.diff)
+                return false;
+        unsigned char t, t2;
+        return Solve(p, t, t2);
+    }
+
+public:
+    static constexpr FileOffset NotFound = ~FileOffset(0);
+
+    // transliterate2 is kept as it is when the word has no uppercase letters.
+    RelativeSearcher(const std::string& w, unsigned char transliterate2)
+        : word(w.substr(0, 255)), default_transliterate2(transliterate2)
+    {
+        for(unsigned i=0; i<word.size(); ++i)
+        {
+            char c = word[i];
+            int* first = (c >= 'A' && c <= 'Z') ? &first_upper : (c >= 'a' && c <= 'z') ? &first_lower : nullptr;
+            if(!first) continue;
+            if(*first < 0)
+                *first = i;
+            else
+                constraints.push_back({ (unsigned char)i, (unsigned char)*first,
+                                        (unsigned char)(c - word[*first]) });
+        }
+    }
+
+    // At least three letters of the same case are needed; anything
+    // less would match nearly everywhere.
+    bool Valid() const { return constraints.size() >= 2; }
+
+    std::size_t size() const { return word.size(); }
+
+    // Finds the transliteration under which the text view shows the word at p.
+    bool Solve(const unsigned char* p, unsigned char& transliterate, unsigned char& transliterate2) const
+    {
+        transliterate2 = default_transliterate2;
+        transliterate  = 0;
+        if(first_upper >= 0)
+            transliterate = word[first_upper] - p[first_upper];
+        if(first_lower >= 0)
+        {
+            unsigned char both = word[first_lower] - p[first_lower];
+            if(first_upper >= 0)
+                transliterate2 = both - transliterate;
+            else
+                transliterate = both - transliterate2;
+        }
+        // Check it, as the lowercase offset can also move uppercase letters.
+        for(unsigned i=0; i<word.size(); ++i)
+        {
+            char c = word[i];
+            if(((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
+            && TextViewChar(p[i], transliterate, transliterate2) != (unsigned char)c)
+                return false;
+        }
+        return true;
+    }
+
+    FileOffset FindFirst(const unsigned char* data, FileOffset begin, FileOffset end) const
+    {
+        const unsigned m = word.size();
+        if(!Valid() || end < begin || end - begin < m) return NotFound;
+        const FileOffset last = end - m;
+
+        FileOffset p = begin;
+    #ifdef SEARCH_HAVE_SIMD
+        for(; p <= last && last - p >= 15; p += 16)
+        {
+            __m128i ok = _mm_set1_epi8(-1);
+            for(const auto& c: constraints)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i*)(data + p + c.pos));
+                __m128i b = _mm_loadu_si128((const __m128i*)(data + p + c.base));
+                ok = _mm_and_si128(ok, _mm_cmpeq_epi8(_mm_sub_epi8(a, b), _mm_set1_epi8(c.diff)));
+            }
+            for(unsigned bits = _mm_movemask_epi8(ok); bits; bits &= bits-1)
+            {
+                FileOffset q = p + __builtin_ctz(bits);
+                unsigned char t, t2;
+                if(Solve(data + q, t, t2)) return q;
+            }
+        }
+    #endif
+        for(; p <= last; ++p)
+            if(Matches(data + p))
+                return p;
+        return NotFound;
+    }
+
+    FileOffset FindLast(const unsigned char* data, FileOffset begin, FileOffset end) const
+    {
+        FileOffset found = NotFound;
+        for(FileOffset p = FindFirst(data, begin, end); p != NotFound; p = FindFirst(data, p+1, end))
+            found = p;
+        return found;
+    }
+};
@@ -0,0 +1,211 @@
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define SIMILAR_HAVE_SIMD 1
+# include <immintrin.h>
+#endif
+
+/* Finds the tiles that look most like a given 8x8 tile.
+ *
+ * A tile is two 64-bit bitplanes, one byte per row. The distance between two
+ * tiles is the number of pixels whose color index differs, i.e. the popcount
+ * of (lo1^lo2)|(hi1^hi2). The given tile is compared in every variant: flipped
+ * horizontally, vertically or both, and with its four colors permuted in each
+ * of the 24 ways; the distance of a candidate is that of the closest variant.
+ *
+ * Candidates are the aligned 16-byte tiles of a range. The AVX2 kernel takes
+ * four consecutive tiles at a time, and counts the bits with the nibble table
+ * lookup (vpshufb) and vpsadbw, as AVX2 has no popcount instruction.
+ */
+class SimilarTiles
+{
+public:
+    struct Match
+    {
+        FileOffset    offset;
+        unsigned      distance;  // Pixels that differ, 0-64
+        unsigned char flip;      // Bit 0 = horizontal, bit 1 = vertical
+        unsigned char colors[4]; // Color c of the given tile is colors[c] in the match
+
+        bool operator< (const Match& b) const
+        {
+            return distance != b.distance ? distance < b.distance : offset < b.offset;
+        }
+    };
+
+private:
+    struct Variant
+    {
+        uint64_t      lo, hi;
+        unsigned char flip, colors[4];
+    };
+    std::vector<Variant> variants;
+
+    static uint64_t Load64(const unsigned char* p)
+    {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        return w;
+    }
+    // Reverses the bits in each byte.
+    static uint64_t MirrorRows(uint64_t x)
+    {
+        x = ((x >> 1) & UINT64_C(0x5555555555555555)) | ((x & UINT64_C(0x5555555555555555)) << 1);
+        x = ((x >> 2) & UINT64_C(0x3333333333333333)) | ((x & UINT64_C(0x3333333333333333)) << 2);
+        x = ((x >> 4) & UINT64_C(0x0F0F0F0F0F0F0F0F)) | ((x & UINT64_C(0x0F0F0F0F0F0F0F0F)) << 4);
+        return x;
+    }
+
+    // Which of the variants is closest to the tile at p.
+    const Variant& Closest(const unsigned char* p, unsigned& distance) const
+    {
+        const uint64_t lo = Load64(p), hi = Load64(p+8);
+        const Variant* best = &variants[0];
+        distance = ~0u;
+        for(const auto& v: variants)
+        {
+            unsigned d = __builtin_popcountll((lo ^ v.lo) | (hi ^ v.hi));
+            if(d < distance) { distance = d; best = &v; }
+        }
+        return *best;
+    }
+
+    // The n closest candidates so far, as a max-heap.
+    struct Best
+    {
+        std::vector<Match> heap;
+        std::size_t        n;
+
+        unsigned Worst() const { return heap.size() < n ? ~0u : heap.front().distance; }
+        void Add(const Match& m)
+        {
+            if(heap.size() < n) { heap.push_back(m); std::push_heap(heap.begin(), heap.end()); }
+            else if(m < heap.front())
+            {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = m;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    };
+    void Consider(Best& best, const unsigned char* data, FileOffset offset, unsigned distance, FileOffset exclude) const
+    {
+        if(distance > best.Worst() || offset == exclude) return;
+        const Variant& v = Closest(data + offset, distance);
+        Match m { offset, distance, v.flip, {} };
+        std::copy_n(v.colors, 4, m.colors);
+        best.Add(m);
+    }
+
+    // The distance to the closest variant, without finding out which one it is.
+    static inline __attribute__((always_inline))
+    unsigned Distance(const std::vector<Variant>& variants, const unsigned char* p)
+    {
+        const uint64_t lo = Load64(p), hi = Load64(p+8);
+        unsigned distance = ~0u;
+        for(const auto& v: variants)
+            distance = std::min(distance, unsigned(__builtin_popcountll((lo ^ v.lo) | (hi ^ v.hi))));
+        return distance;
+    }
+
+    void ScanScalar(Best& best, const unsigned char* data, FileOffset begin, std::size_t n, FileOffset exclude) const
+    {
+        for(std::size_t u=0; u<n; ++u)
+            Consider(best, data, begin + u*16, Distance(variants, data + begin + u*16), exclude);
+    }
+
+#ifdef SIMILAR_HAVE_SIMD
+    __attribute__((target("popcnt")))
+    void ScanPOPCNT(Best& best, const unsigned char* data, FileOffset begin, std::size_t n, FileOffset exclude) const
+    {
+        for(std::size_t u=0; u<n; ++u)
+            Consider(best, data, begin + u*16, Distance(variants, data + begin + u*16), exclude);
+    }
+
+    __attribute__((target("avx2")))
+    void ScanAVX2(Best& best, const unsigned char* data, FileOffset begin, std::size_t n, FileOffset exclude) const
+    {
+        const __m256i nibble_bits = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                                     0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+        const __m256i low4 = _mm256_set1_epi8(0x0F), zero = _mm256_setzero_si256();
+
+        std::size_t u = 0;
+        for(; u+4 <= n; u += 4)
+        {
+            const unsigned char* p = data + begin + u*16;
+            __m256i a  = _mm256_loadu_si256((const __m256i*)p);
+            __m256i b  = _mm256_loadu_si256((const __m256i*)(p + 32));
+            __m256i lo = _mm256_unpacklo_epi64(a, b); // Tiles 0,2,1,3
+            __m256i hi = _mm256_unpackhi_epi64(a, b);
+
+            __m256i dist = _mm256_set1_epi32(-1);
+            for(const auto& v: variants)
+            {
+                __m256i m = _mm256_or_si256(_mm256_xor_si256(lo, _mm256_set1_epi64x(v.lo)),
+                                            _mm256_xor_si256(hi, _mm256_set1_epi64x(v.hi)));
+                __m256i c = _mm256_add_epi8(_mm256_shuffle_epi8(nibble_bits, _mm256_and_si256(m, low4)),
+                                            _mm256_shuffle_epi8(nibble_bits, _mm256_and_si256(_mm256_srli_epi16(m, 4), low4)));
+                dist = _mm256_min_epu32(dist, _mm256_sad_epu8(c, zero));
+            }
+
+            alignas(32) uint32_t d[8];
+            _mm256_store_si256((__m256i*)d, dist);
+            static const unsigned char order[4] = { 0, 2, 1, 3 };
+            for(unsigned l=0; l<4; ++l)
+                Consider(best, data, begin + (u + order[l])*16, d[l*2], exclude);
+        }
+        ScanPOPCNT(best, data, begin + u*16, n - u, exclude);
+    }
+#endif
+
+public:
+    explicit SimilarTiles(const unsigned char* tile)
+    {
+        unsigned char colors[4] = { 0,1,2,3 };
+        do {
+            for(unsigned flip=0; flip<4; ++flip)
+            {
+                uint64_t lo = Load64(tile), hi = Load64(tile+8);
+                if(flip & 1) { lo = MirrorRows(lo);         hi = MirrorRows(hi); }
+                if(flip & 2) { lo = __builtin_bswap64(lo);  hi = __builtin_bswap64(hi); }
+
+                // The pixels of each color, recolored.
+                const uint64_t mask[4] = { ~lo & ~hi, lo & ~hi, ~lo & hi, lo & hi };
+                Variant v { 0, 0, (unsigned char)flip, { colors[0], colors[1], colors[2], colors[3] } };
+                for(unsigned c=0; c<4; ++c)
+                {
+                    if(colors[c] & 1) v.lo |= mask[c];
+                    if(colors[c] & 2) v.hi |= mask[c];
+                }
+                // Symmetric tiles, and tiles with fewer than four colors, give the same variant many times.
+                if(std::none_of(variants.begin(), variants.end(),
+                                [&](const Variant& w) { return w.lo == v.lo && w.hi == v.hi; }))
+                    variants.push_back(v);
+            }
+        } while(std::next_permutation(colors, colors+4));
+    }
+
+    // Returns the (at most) n tiles that are closest to the given tile, best first,
+    // among the "count" tiles that begin at data+begin. The tile at "exclude"
+    // is not considered.
+    std::vector<Match> Find(const unsigned char* data, FileOffset begin, std::size_t count,
+                            std::size_t n, FileOffset exclude) const
+    {
+        Best best { {}, n };
+        if(n == 0) return {};
+    #ifdef SIMILAR_HAVE_SIMD
+        static const bool have_avx2   = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+        static const bool have_popcnt = __builtin_cpu_supports("popcnt");
+        if(have_avx2)        ScanAVX2(best, data, begin, count, exclude);
+        else if(have_popcnt) ScanPOPCNT(best, data, begin, count, exclude);
+        else
+    #endif
+        ScanScalar(best, data, begin, count, exclude);
+
+        std::sort_heap(best.heap.begin(), best.heap.end());
+        return std::move(best.heap);
+    }
+};
@@ -0,0 +1,145 @@
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+/* Index of identical tiles.
+ *
+ * The image is cut into units of 16 bytes (one 8x8 tile), or 32 bytes
+ * (an 8x16 sprite) when tall sprites are shown, starting from "origin".
+ * Units with the same contents are chained together in ascending order,
+ * so that all occurrences of a tile can be listed from any one of them.
+ *
+ * The chains are built with an open-addressing hash table keyed on the
+ * contents. The hashes are computed in parallel first; then the table is
+ * split into shards by the top bits of the hash, and each shard is filled
+ * by one worker, so that no locking is needed. Each worker inserts its
+ * units from the last to the first, prepending to the chains, which then
+ * come out in ascending order.
+ */
+class TileIndex
+{
+    static constexpr std::size_t MaxUnits = std::size_t(1) << 22;
+
+    struct Slot { uint32_t head, count; }; // First unit of the chain; count 0 = empty slot
+
+    const unsigned char* data   = nullptr;
+    FileOffset           origin = 0;
+    unsigned             unit   = 0;
+    std::size_t          n_units = 0;
+    bool                 built  = false;
+
+    unsigned                        shard_bits = 0;
+    std::vector<std::vector<Slot>>  shards;
+    std::vector<uint32_t>           next; // Next unit with the same contents, or ~0u
+
+    static uint32_t Hash(const unsigned char* p, unsigned len)
+    {
+        uint64_t h = len;
+        for(unsigned n=0; n<len; n += 8)
+        {
+            uint64_t w;
+            std::memcpy(&w, p+n, 8);
+            h = (h ^ w) * UINT64_C(0x9E3779B97F4A7C15);
+            h ^= h >> 29;
+        }
+        h *= UINT64_C(0xBF58476D1CE4E5B9);
+        return h >> 32;
+    }
+    const unsigned char* Unit(std::size_t n) const { return data + origin + n * unit; }
+
+    std::size_t ShardOf(uint32_t hash) const { return shard_bits ? hash >> (32 - shard_bits) : 0; }
+
+    // The slot for the contents at p, or the empty slot where they would go.
+    std::size_t Probe(const std::vector<Slot>& table, const unsigned char* p, uint32_t hash) const
+    {
+        const std::size_t mask = table.size() - 1;
+        for(std::size_t s = hash & mask; ; s = (s+1) & mask)
+            if(!table[s].count || !std::memcmp(Unit(table[s].head), p, unit))
+                return s;
+    }
+
+public:
+    static constexpr FileOffset NotFound = ~FileOffset(0);
+
+    // Indexes image[origin..] in units of unit_size bytes (a multiple of 8).
+    // Images with more than MaxUnits units are not indexed.
+    void Build(const ROMimage& image, FileOffset origin_, unsigned unit_size, WorkerPool& workers)
+    {
+        origin  = origin_;
+        unit    = unit_size;
+        data    = image.size() ? &image[0] : nullptr;
+        n_units = image.size() > origin ? (image.size() - origin) / unit : 0;
+        built   = n_units <= MaxUnits;
+        shards.clear();
+        next.clear();
+        if(!built) return;
+
+        const std::size_t Chunk = 16384;
+        std::vector<uint32_t> hashes(n_units);
+        workers.Run((n_units + Chunk-1) / Chunk, [&](unsigned c)
+        {
+            for(std::size_t n = c*Chunk, e = std::min(n + Chunk, n_units); n < e; ++n)
+                hashes[n] = Hash(Unit(n), unit);
+        });
+
+        shard_bits = 0;
+        while((1u << shard_bits) < workers.Size() * 2) ++shard_bits;
+        shards.resize(1u << shard_bits);
+        next.assign(n_units, ~0u);
+
+        workers.Run(shards.size(), [&](unsigned shard)
+        {
+            std::size_t mine = 0;
+            for(uint32_t h: hashes) mine += ShardOf(h) == shard;
+            std::size_t size = 16;
+            while(size < mine + mine/2) size *= 2; // Load factor at most 2/3
+
+            std::vector<Slot>& table = shards[shard];
+            table.assign(size, Slot{0,0});
+            for(std::size_t n = n_units; n-- > 0; )
+                if(ShardOf(hashes[n]) == shard)
+                {
+                    Slot& s = table[Probe(table, Unit(n), hashes[n])];
+                    if(s.count) next[n] = s.head;
+                    s.head = n;
+                    ++s.count;
+                }
+        });
+    }
+
+    bool       Built()  const { return built; }
+    unsigned   UnitSize() const { return unit; }
+    FileOffset Origin() const { return origin; }
+
+    // The start of the unit that contains the offset, or NotFound if it is not indexed.
+    FileOffset Align(FileOffset offset) const
+    {
+        if(!built || offset < origin || (offset - origin) / unit >= n_units) return NotFound;
+        return offset - (offset - origin) % unit;
+    }
+
+    // How many times the contents of the unit at offset occur, and the first of them.
+    // The offset must be the start of an indexed unit.
+    std::pair<FileOffset,std::size_t> Occurrences(FileOffset offset) const
+    {
+        const unsigned char*     p     = data + offset;
+        const uint32_t           hash  = Hash(p, unit);
+        const std::vector<Slot>& table = shards[ShardOf(hash)];
+        const Slot&              s     = table[Probe(table, p, hash)];
+        return { origin + FileOffset(s.head) * unit, s.count };
+    }
+    // The next unit with the same contents, or NotFound after the last one.
+    FileOffset Next(FileOffset offset) const
+    {
+        uint32_t n = next[(offset - origin) / unit];
+        return n == ~0u ? NotFound : origin + FileOffset(n) * unit;
+    }
+    // The previous unit with the same contents, or NotFound before the first one.
+    FileOffset Prev(FileOffset offset) const
+    {
+        FileOffset prev = NotFound;
+        for(FileOffset o = Occurrences(offset).first; o < offset; o = Next(o))
+            prev = o;
+        return prev;
+    }
+};
@@ -0,0 +1,2003 @@
+#include <SDL.h>
+#include <vector>
+#include <tuple>
+#include <cstdio>
+#include <signal.h>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+
+class UIfontBase { };
+#include "font/6x9.inc"
+#include "font/8x16.inc"
+
+#include "crc32.h"
+#include "mario.hh"
+#include "palette.hh"
+#include "glyphs.hh"
+#include "chr.hh"
+#include "lineset.hh"
+#include "workers.hh"
+#include "romimage.hh"
+#include "imagefile.hh"
+#include "profiler.hh"
+#include "search.hh"
+#include "layout.hh"
+#include "blockindex.hh"
+#include "tileindex.hh"
+#include "similar.hh"
+#include "rowcache.hh"
+#include "disasm.hh"
+
+template<typename T>
+static T constexpr constmin(T a, T b) { return a<b ? a : b; }
+template<typename T>
+static T constexpr constmax(T a, T b) { return a>b ? a : b; }
+
+static constexpr unsigned FontWidth      = 6;
+static constexpr unsigned FontHeight     = 9;
+
+static constexpr unsigned LeftWidth     = FontWidth*17;
+static constexpr unsigned LeftMargin    = 4;
+
+// Bytes per line. The window is laid out for as many as fit in its width,
+// doubling from MinCharsPerLine, so that PRG banks, CHR pages and the
+// jump targets always begin a line.
+static constexpr unsigned MinCharsPerLine = 16;
+static constexpr unsigned DflCharsPerLine = 32;
+static constexpr unsigned MaxCharsPerLine = 256;
+
+static constexpr unsigned TextLeftMargin   = 1;
+static constexpr unsigned TextRightMargin  = 4;
+
+// Next to the text view, the lines are also shown as tiles, always at this scale.
+// A tile is then taller than a line, so the lines go in groups as tall as a tile
+// (two lines, or four with 8x16 sprites), and each line shows its pixel rows of
+// all the tiles of its group: CharsPerLine/8 tiles side by side.
+static constexpr unsigned PreviewScale  = 2;
+static constexpr unsigned PreviewWidthFor(unsigned chars) { return chars/8 * 8*PreviewScale; }
+
+// A 16x16 box of tiles (128*128 pixels) is 0x1000 bytes.
+// 0x1000 bytes translates into 0x1000/CharsPerLine lines of text,
+// e.g. 32x128 characters, i.e. 640x1152 pixels at our select font size.
+// The CHR view is scaled as large as fits in that, and in the width
+// of the text view; see GFXviewScaleFor().
+static constexpr unsigned MaxGFXviewScale = 4;
+
+static constexpr unsigned ROMpageSize  = 16384;
+static constexpr unsigned VROMpageSize = 8192;
+
+// The minimap is a strip to the right of the dump that shows the whole image,
+// colored by what each part seems to contain: a marker of MinimapMarker pixels,
+// and the colors.
+static constexpr unsigned MinimapWidth  = 12;
+static constexpr unsigned MinimapMarker = 2;
+
+static const char hexbytes[16] =
+    {'0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F'};
+
+// Hex view layout: each byte is two characters followed by a gap
+// of 5 pixels after every 16th byte, 3 after every 4th, and 1 otherwise.
+static constexpr unsigned HexCellWidth = FontWidth*2;
+static constexpr struct HexLayoutTable
+{
+    unsigned short x[MaxCharsPerLine+1]; // x coordinate of each byte; x[n] is the end of n bytes
+    unsigned char  gap[MaxCharsPerLine];
+
+    constexpr HexLayoutTable() : x{}, gap{}
+    {
+        for(unsigned p=0; p<MaxCharsPerLine; ++p)
+        {
+            gap[p]   = (p+1)%16 == 0 ? 5 : ((p+1)%4 == 0 ? 3 : 1);
+            x[p+1]   = x[p] + HexCellWidth + gap[p];
+        }
+    }
+} HexLayout{};
+
+// The width of the hex view at "chars" bytes per line.
+static constexpr unsigned HexViewWidthFor(unsigned chars)
+{
+    return chars * FontWidth*2
+         + (chars/16) * (5)
+         + (chars/4 - chars/16)  * (3)
+         + (chars - chars/4 - chars/16) * 1;
+}
+// The width of the dump (everything but the minimap) at "chars" bytes per line.
+static constexpr unsigned DumpWidthFor(unsigned chars)
+{
+    return LeftWidth + LeftMargin + HexViewWidthFor(chars)
+         + TextLeftMargin + chars*FontWidth + TextRightMargin + PreviewWidthFor(chars);
+}
+// The scale of the CHR view at "chars" bytes per line: as large as fits
+// to the right of the hex view, and within the lines of one 0x1000-byte page.
+static constexpr unsigned GFXviewScaleFor(unsigned chars)
+{
+    return constmax(1u, constmin(MaxGFXviewScale,
+                        constmin((TextLeftMargin + chars*FontWidth + TextRightMargin + PreviewWidthFor(chars)) / 128,
+                                 0x1000 / chars * FontHeight / 128)));
+}
+
+static constexpr unsigned DflWidth = DumpWidthFor(DflCharsPerLine) + MinimapWidth;
+static constexpr unsigned MinWidth = DumpWidthFor(MinCharsPerLine) + MinimapWidth;
+
+static constexpr unsigned DflHeight =
+    //FontHeight * (0x600/CharsPerLine)
+    //DflWidth*9/16
+    480
+    ;
+// The height follows the window; the status bar, the bottom bar and a few lines
+// of the dump always fit.
+static constexpr unsigned MinHeight = 2*16 + 8*FontHeight;
+
+/*
+01234567890123456 = 17 (left width)
+00013AAF(00:FAAF)
+*/
+
+static unsigned char transliterate = 0, transliterate2 = 0;
+static unsigned      mousey        = 0, mousex = 0;
+static unsigned FirstLineLength = 0;//16;
+static unsigned NumHeaderLines  = 0;//1;
+static unsigned CharsPerLine    = DflCharsPerLine; // Follows the window width
+
+static bool TallSprites = false;
+static bool Disassembly = false; // PRG lines show the instructions instead of text
+
+// Everything besides the ROM image that the render functions read
+// and that input handling can change. A copy is taken for each frame,
+// so that render threads never see it change under them.
+struct RenderState
+{
+    unsigned char transliterate, transliterate2;
+    bool          TallSprites;
+    unsigned      FirstLineLength, NumHeaderLines, CharsPerLine;
+    FileOffset    ScrollBegin;
+    unsigned      MarioTimer;
+    std::string   Status, Bottom;
+    FileOffset    HighlightBegin, HighlightEnd; // The current search match
+    bool          Disassembly;
+    std::size_t   CodeVersion;                  // Changes whenever the code index has something new
+
+    FileOffset GetBeginOffset(FileOffset line) const
+    {
+        if(line == 0) return 0;
+        return FirstLineLength + (line-NumHeaderLines) * CharsPerLine;
+    }
+};
+
+// The keys that move the view a page or more at a time
+enum Jump { JumpPageUp, JumpPageDown, JumpBankUp, JumpBankDown, JumpHome, JumpEnd, NumJumps };
+
+enum SearchMode  { SearchHex, SearchText, SearchRelative };
+enum SearchScope { SearchAll, SearchPRG, SearchCHR };
+
+class ROMviewer
+{
+public:
+    struct
+    {
+        unsigned n_rom16k;
+        unsigned n_vrom8k;
+    } header;
+
+    ROMimage   image;
+    BlockIndex index{image};
+
+    SDL_Window*   window   = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture*  texture  = nullptr;
+    Palette            palette;
+    std::vector<Pixel> framebuffer;
+    FileOffset ScrollBegin;
+
+    // The size of the framebuffer, and how many screen pixels one framebuffer pixel is.
+    // The framebuffer follows the size of the window: the rows are as many as fit,
+    // and the columns are laid out for CharsPerLine; see SetColumns().
+    unsigned width = DflWidth, height = DflHeight, zoom = 1;
+    unsigned Viewport() const { return height - 2*16; } // Rows of the dump area
+
+    // The columns of the dump at CharsPerLine bytes per line
+    unsigned HexViewWidth, TextViewWidth, DumpWidth, StatusWidth;
+    unsigned GFXviewScale, GFXviewWidth, GFXviewHeight;
+
+    GlyphCache<FontWidth,FontHeight> glyphs;
+    GlyphCache<9,16>                 bigglyphs;
+
+    // The bottom bar without Mario, as it was last rendered, and where Mario is drawn on it
+    std::vector<Pixel>    bottom_bar;
+    MarioSprite           mario;
+    struct MarioPos
+    {
+        unsigned pose, phase;
+        int      x;
+        bool operator== (const MarioPos& b) const { return pose == b.pose && phase == b.phase && x == b.x; }
+    } mario_drawn {};
+
+    // Palette indexes, and span tables for each color combination used while rendering.
+    // These are resolved up front, so that rendering never modifies the glyph caches
+    // nor the palette.
+    struct
+    {
+        GlyphCache<FontWidth,FontHeight>::Colors left, hex[3], text[2][4], found;
+        GlyphCache<9,16>::Colors                 status, bottom;
+        Pixel black, white, gray, left_gap, past_end, mario_on, mario_body;
+        Pixel chr[4];                      // Entries of their own, see SetCHRcolors()
+        Pixel minimap[NumBlockClasses];
+        GlyphCache<FontWidth,FontHeight>::Colors disasm[4]; // See RenderCode()
+    } colors;
+    unsigned chr_colors = 0; // Which set of colors the CHR view uses
+
+    // The bytes of the dump lines, and how they appear in the text view
+    typedef LayoutCache<MaxCharsPerLine>::Line LineLayout;
+    LayoutCache<MaxCharsPerLine> layouts;
+
+    // Pre-rendered hex bytes: [colorscheme][pixel row][byte value][HexCellWidth]
+    // Colorscheme 2 is the search match highlight.
+    std::vector<Pixel> hexcells;
+
+    // The search prompt, and the match that was found last
+    struct
+    {
+        bool        active = false; // The prompt is open
+        SearchMode  mode   = SearchHex;
+        SearchScope scope  = SearchAll;
+        std::string query;
+        bool        valid  = false; // The query parses
+        double      origin_aim = 0; // Where the view was when the prompt was opened
+        FileOffset  origin = 0;
+        unsigned char origin_transliterate = 0, origin_transliterate2 = 0;
+        FileOffset  hit = PatternSearcher::NotFound, hit_length = 0;
+    } search;
+
+    // Minimap color of each row of the dump area, and how far the index was then
+    std::vector<Pixel>    minimap;
+    std::size_t           minimap_done   = 0;
+    unsigned              minimap_params = ~0u;
+    std::chrono::steady_clock::time_point minimap_time;
+
+    // Identical tiles, and the occurrence that was stepped to last
+    TileIndex tiles;
+    struct
+    {
+        FileOffset first = TileIndex::NotFound; // Identifies the tile: its first occurrence
+        FileOffset at    = TileIndex::NotFound;
+        unsigned   mousex = 0, mousey = 0;      // Where the mouse was then
+    } dup;
+
+    // The tiles that look like a given one, and the one that was stepped to last
+    struct
+    {
+        FileOffset  source = TileIndex::NotFound;
+        std::vector<SimilarTiles::Match> matches;
+        std::size_t at = 0;
+        unsigned    mousex = 0, mousey = 0;
+    } similar;
+
+    // Where each 16 kB PRG bank is assumed to be mapped: the last one at $C000
+    // and the others at $8000, until changed with ToggleBankMapping().
+    std::vector<unsigned> bank_base;
+
+    // Instruction boundaries in the PRG banks, for the disassembly. The index
+    // is only built while the disassembly is shown; code_mapped is the mapping
+    // that it was last given, and code_published how far it was then drawn.
+    std::unique_ptr<CodeIndex> code;
+    std::vector<unsigned>      code_mapped;
+    std::size_t                code_published = 0;
+
+    // Rows rendered ahead, around the view and where the jump keys lead
+    static constexpr unsigned AheadViewports = 2 * NumJumps;
+    RowCache ahead{DflWidth - MinimapWidth, AheadViewports * (DflHeight - 2*16)};
+    FileOffset ahead_complete = ~FileOffset(0); // The view for which everything is rendered ahead
+
+    WorkerPool workers;
+
+    FrameProfiler profiler;
+    bool          ShowTimings = false; // Show the profiler averages in the status bar
+public:
+    ROMviewer(ROMimage&& romdata)
+        : image(std::move(romdata)), glyphs(font6x9()), bigglyphs(font8x16())
+    {
+        SetColumns(DflCharsPerLine);
+        framebuffer.resize(width*height);
+        bottom_bar.resize(width*16);
+
+        if(image.size() >= 16 && image[0]=='N' && image[1]=='E' && image[2]=='S' && image[3]==0x1A)
+        {
+            header.n_rom16k = image[0x04];
+            header.n_vrom8k = image[0x05];
+            FirstLineLength = 16;
+            NumHeaderLines = 1;
+        }
+        else
+        {
+            header.n_rom16k = 0;
+            header.n_vrom8k = 0;
+            FirstLineLength = 0;
+            NumHeaderLines = 0;
+        }
+        bank_base.assign(header.n_rom16k, 0x8000);
+        if(!bank_base.empty()) bank_base.back() = 0xC000;
+        code.reset(new CodeIndex(image, FirstLineLength, header.n_rom16k));
+
+        BuildColors();
+        BuildHexCells();
+
+        ScrollBegin = 0;
+        minimap.assign(Viewport(), MinimapColor(BlockUnknown));
+        dirty_lines.Resize(height);
+        in_need_of_refreshing.Resize(height);
+        in_need_of_refreshing.SetRange(0, height); // The texture starts out undefined
+    }
+
+    // Creates the window. Until this is called, the viewer can only
+    // render into memory; SDL is not initialized at all.
+    void OpenWindow()
+    {
+        SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
+        SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
+        SDL_EventState(SDL_KEYUP, SDL_IGNORE); // Ignore keyup events
+
+        window = SDL_CreateWindow("hex viewer",
+                                  SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                  DflWidth*2, DflHeight*2, SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+        // Presenting waits for the vertical blank, which paces the scroll animation.
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+
+        double aim_pos = 0;
+        WindowResized(aim_pos);
+        signal(SIGINT, SIG_DFL);
+    }
+
+    // Fits the framebuffer to the window. The zoom is that of the display
+    // (2 on high-DPI ones), so that the framebuffer is shown 1:1 or at twice
+    // the size; the rows are as many as fit, and the lines as many bytes long
+    // as fit. A window too small for the narrowest layout shows it scaled down.
+    // Called when the window is created and whenever its size changes; the
+    // byte at the top of the view stays there.
+    void WindowResized(double& aim_pos)
+    {
+        int w = DflWidth, h = DflHeight, points_w = 0, points_h = 0;
+        SDL_GetRendererOutputSize(renderer, &w, &h); // In pixels, also on high-DPI displays
+        SDL_GetWindowSize(window, &points_w, &points_h);
+        unsigned z    = std::max(1, points_w > 0 ? w / points_w : 1);
+        unsigned cols = std::max(1u, unsigned(w) / z), rows = std::max(1u, unsigned(h) / z);
+        const bool fits = cols >= MinWidth && rows >= MinHeight;
+        if(!fits)
+        {
+            double shrink = std::max(MinWidth / double(cols), MinHeight / double(rows));
+            cols = std::max(MinWidth,  unsigned(cols * shrink));
+            rows = std::max(MinHeight, unsigned(rows * shrink));
+        }
+        unsigned chars = MaxCharsPerLine;
+        while(chars > MinCharsPerLine && DumpWidthFor(chars) + MinimapWidth > cols)
+            chars /= 2;
+        if(texture && z == zoom && chars == CharsPerLine && rows == height) return;
+
+        FileOffset top = GetBeginOffset(FileOffset(aim_pos) / FontHeight);
+        zoom = z;
+        SetColumns(chars);
+        Resize(rows);
+        aim_pos = GetLineForOffset(top) * double(FontHeight);
+
+        if(texture) SDL_DestroyTexture(texture);
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width,height);
+        // Mouse coordinates are then reported in framebuffer pixels.
+        // The columns that the lines do not fill are left black on both sides.
+        SDL_RenderSetLogicalSize(renderer, width, height);
+        SDL_RenderSetIntegerScale(renderer, fits ? SDL_TRUE : SDL_FALSE);
+    }
+
+    // How long each frame stays on the display the window is on.
+    std::chrono::microseconds RefreshPeriod() const
+    {
+        SDL_DisplayMode mode;
+        int hz = 60;
+        if(SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0)
+            hz = mode.refresh_rate;
+        return std::chrono::microseconds(1000000 / hz);
+    }
+
+    // Lays out the dump for "chars" bytes per line. Resize() must follow.
+    void SetColumns(unsigned chars)
+    {
+        CharsPerLine  = chars;
+        HexViewWidth  = HexViewWidthFor(chars);
+        TextViewWidth = chars * FontWidth;
+        DumpWidth     = DumpWidthFor(chars);
+        width         = DumpWidth + MinimapWidth;
+        StatusWidth   = width / 9;
+        GFXviewScale  = GFXviewScaleFor(chars);
+        GFXviewWidth  = GFXviewHeight = 128 * GFXviewScale;
+    }
+
+    // Changes the number of rows, or the columns after SetColumns().
+    // Everything is rendered again.
+    void Resize(unsigned rows)
+    {
+        height = rows;
+        framebuffer.assign(width*height, colors.black);
+        bottom_bar.assign(width*16, colors.black);
+        minimap.assign(Viewport(), MinimapColor(BlockUnknown));
+        minimap_done = ~std::size_t(0); // Redraw it as soon as possible
+        ahead = RowCache(DumpWidth, AheadViewports * Viewport());
+        ahead_complete = ~FileOffset(0);
+        dirty_lines.Resize(height);
+        in_need_of_refreshing.Resize(height);
+        in_need_of_refreshing.SetRange(0, height);
+        fresh = false;
+        MakeDirty();
+    }
+
+    RenderState CaptureState() const
+    {
+        FileOffset hl_begin = 0, hl_end = 0;
+        if(search.hit != PatternSearcher::NotFound)
+            { hl_begin = search.hit; hl_end = search.hit + search.hit_length; }
+        return { transliterate, transliterate2, TallSprites,
+                 FirstLineLength, NumHeaderLines, CharsPerLine,
+                 ScrollBegin, MarioTimer, Status, Bottom,
+                 hl_begin, hl_end,
+                 Disassembly, Disassembly ? code_published : 0 };
+    }
+
+    FileOffset GetBeginOffset(FileOffset line) const
+    {
+        if(line == 0) return 0;
+        return FirstLineLength + (line-NumHeaderLines) * CharsPerLine;
+    }
+    // Returns the line that contains the given offset.
+    FileOffset GetLineForOffset(FileOffset offset) const
+    {
+        if(offset < FirstLineLength) return 0;
+        return NumHeaderLines + (offset - FirstLineLength) / CharsPerLine;
+    }
+    std::pair<size_t,size_t> GetROMaddr(FileOffset line) const
+    {
+        return GetROMaddrForOffset(GetBeginOffset(line));
+    }
+    std::pair<size_t,size_t> GetROMaddrForOffset(FileOffset offset) const
+    {
+        if(offset == 0) return {0,0};
+        offset -= FirstLineLength;
+        if(offset < header.n_rom16k * ROMpageSize)
+        {
+            std::size_t pageno = offset / ROMpageSize, pageptr = offset % ROMpageSize;
+            return { pageno, pageptr + bank_base[pageno] };
+        }
+        offset -= header.n_rom16k * ROMpageSize;
+        std::size_t pageno = offset / VROMpageSize, pageptr = offset % VROMpageSize;
+        return { pageno, pageptr };
+    }
+    // Formats the 17-character address that appears in the left column.
+    // Offsets beyond 4 GB do not leave room for the page number.
+    void FormatAddress(char* Buf, FileOffset offset) const
+    {
+        std::size_t ROMpage, ROMoffs;
+        std::tie(ROMpage,ROMoffs) = GetROMaddrForOffset(offset);
+
+        if(offset <= 0xFFFFFFFFu)
+            std::sprintf(Buf, "%08X(%02X:%04X)", unsigned(offset), unsigned(ROMpage), unsigned(ROMoffs));
+        else
+            std::sprintf(Buf, "%011llX(%04X)", (unsigned long long)offset, unsigned(ROMoffs));
+    }
+    void RenderLine(unsigned yoffset)
+    {
+        RenderLine(yoffset, CaptureState());
+    }
+    void RenderLine(unsigned yoffset, const RenderState& rs)
+    {
+        if(yoffset >= height) return;
+
+        Pixel* scanline = &framebuffer[0] + yoffset * width;
+
+        if(yoffset < 16)
+        {
+            for(unsigned x=0; x<StatusWidth; ++x)
+                bigglyphs.Put(scanline + x*9, colors.status, x < rs.Status.size() ? rs.Status[x] : ' ', yoffset);
+        }
+        else if(yoffset >= height - 16)
+        {
+            yoffset -= (height - 16);
+
+            for(unsigned x=0; x<StatusWidth; ++x)
+                bigglyphs.Put(scanline + x*9, colors.bottom, x < rs.Bottom.size() ? rs.Bottom[x] : ' ', yoffset);
+            std::copy_n(scanline, width, &bottom_bar[yoffset * width]);
+
+            DrawMario(scanline, yoffset, GetMarioPos(rs.MarioTimer));
+        }
+        else
+        {
+            RenderDumpLine(scanline, yoffset + rs.ScrollBegin - 16, rs);
+            RenderMinimap(scanline, yoffset - 16, rs);
+        }
+    }
+
+    void RenderDumpLine(Pixel* scanline, FileOffset yoffset, const RenderState& rs)
+    {
+        FileOffset line = yoffset / FontHeight;
+        unsigned   pixoffset = yoffset % FontHeight;
+        FileOffset BeginOffset = rs.GetBeginOffset(line);
+
+        if(BeginOffset >= image.size())
+        {
+            std::fill_n(scanline, DumpWidth, colors.past_end);
+            return;
+        }
+
+        LineLayout local;
+        const LineLayout& layout = GetLayout(line, BeginOffset, rs, local);
+        const FoundRange  found  = Found(layout, rs);
+
+        RenderLeft(scanline, BeginOffset, pixoffset);
+        RenderHex(scanline,  layout, found, pixoffset);
+
+        if(BeginOffset < rs.FirstLineLength + header.n_rom16k * ROMpageSize)
+        {
+            RenderText(scanline, layout, found, pixoffset, rs);
+        }
+        else
+        {
+            FileOffset NonVROMsize = rs.FirstLineLength + header.n_rom16k * ROMpageSize;
+            // How many lines does non-VROM take?
+            FileOffset NonVROMlines = rs.NumHeaderLines + (NonVROMsize - rs.FirstLineLength) / rs.CharsPerLine;
+            // How many bytes into VROM are we?
+            FileOffset GFXoffset          = BeginOffset - NonVROMsize;
+            // Where does THIS VROM page begin?
+            FileOffset GFXpageBeginOffset = GFXoffset & ~FileOffset(0xFFF);
+
+            // Which pixel-yoffset does that page begin at?
+            FileOffset line_that_begins_block =
+                NonVROMlines + GFXpageBeginOffset / rs.CharsPerLine;
+
+            FileOffset ypixel_that_begins_block =
+                FontHeight * line_that_begins_block;
+
+            // Which y-pixel are we going at, relative to the beginning of this block?
+            unsigned ypixel_relative = yoffset - ypixel_that_begins_block;
+            //fprintf(stderr, "At offset=%08X, yoffset=%u, ypixel_relative=%u, pagebegin=%X\n",
+            //    BeginOffset, yoffset, ypixel_relative, GFXpageBeginOffset);
+
+            if(ypixel_relative >= GFXviewHeight)
+            {
+                unsigned skip = LeftWidth + LeftMargin + HexViewWidth;
+                std::fill_n(scanline + skip, GFXviewWidth, colors.gray);
+                std::fill_n(scanline + skip + GFXviewWidth, DumpWidth - skip - GFXviewWidth, colors.black);
+            }
+            else
+            {
+                // 16 tiles per scanline. 16 bytes per tile.
+                unsigned ypixel_unscale = ypixel_relative / GFXviewScale;
+
+                // rom(tileno,scanline) = {byte1:tileno*16+scanline, byte2:tileno*16+8+scanline}
+                // tileno(x,y)          = {tileno: (x/8) + (y/8)*16, scanline:y%8 }
+                // rom(x,y)             = {byte1:((x/8) + (y/8)*16)*16 +     y%8,
+                //                         byte2:((x/8) + (y/8)*16)*16 + 8 + y%8}
+                unsigned skip = LeftWidth + LeftMargin + HexViewWidth;
+                scanline += skip;
+                RenderGFX(scanline,
+                          GFXrowOffset(NonVROMsize + GFXpageBeginOffset + (ypixel_unscale/8)*16*16 + (ypixel_unscale%8),
+                                       rs.TallSprites),
+                          GFXviewWidth, GFXviewScale, rs.TallSprites ? 32 : 16);
+
+                std::fill_n(scanline+GFXviewWidth, DumpWidth - skip-GFXviewWidth, colors.black);
+            }
+        }
+    }
+    void RenderLeft(Pixel* scanline, FileOffset ROMoffset, unsigned whichline)
+    {
+        if(whichline >= FontHeight)
+            std::fill_n(scanline, LeftWidth, colors.left_gap);
+        else
+        {
+            char Buf[64];
+            FormatAddress(Buf, ROMoffset);
+            for(unsigned p=0, x=0; p<LeftWidth/FontWidth; x+=FontWidth, ++p)
+                glyphs.Put(scanline+x, colors.left, Buf[p], whichline);
+        }
+    }
+    void BuildColors()
+    {
+        auto C = [&](uint32_t color) { return palette.Index(color); };
+
+        colors.black    = C(0x000000);
+        colors.white    = C(0xFFFFFF);
+        colors.gray     = C(0x888888);
+        colors.left_gap = C(0x404040);
+        colors.past_end = C(0x488888);
+
+        colors.status = bigglyphs.GetColors(C(0xAAAAAA), C(0x0000AA));
+        colors.bottom = bigglyphs.GetColors(C(0x000000), C(0x00AAAA));
+        colors.left   = glyphs.GetColors(C(0xFFFFFF), C(0x000000));
+        colors.mario_on   = C(0x555555);
+        colors.mario_body = C(0x0AAAAA);
+
+        // The hex and text colorschemes alternate every four bytes.
+        colors.hex[0] = glyphs.GetColors(C(0xD0D0D0), C(0x000000));
+        colors.hex[1] = glyphs.GetColors(C(0xCCCCCC), C(0x000000));
+        colors.hex[2] = glyphs.GetColors(C(0x000000), C(0xF0F055));
+        colors.found  = colors.hex[2];
+
+        static const unsigned text_bg[2] = { 0x000000, 0x000050 };
+        static const unsigned text_fg[2][4] =
+        {
+            // plain,  alnum,    control,  high
+            { 0xD0D0D0, 0xF0F055, 0xA07010, 0xA050EF },
+            { 0xCCCCCC, 0xF0F055, 0xA07010, 0xA050EF },
+        };
+        for(unsigned scheme=0; scheme<2; ++scheme)
+            for(unsigned cls=0; cls<4; ++cls)
+                colors.text[scheme][cls] = glyphs.GetColors(C(text_fg[scheme][cls]), C(text_bg[scheme]));
+
+        static const uint32_t minimap_colors[NumBlockClasses] =
+        {
+            0x202020, // unknown (not indexed yet)
+            0x505050, // fill
+            0xF0F055, // text
+            0xFF556B, // tiles
+            0xA050EF, // compressed or random
+            0x3070B0, // code or other data
+        };
+        for(unsigned c=0; c<NumBlockClasses; ++c)
+            colors.minimap[c] = C(minimap_colors[c]);
+
+        static const uint32_t disasm_fg[4] =
+        {
+            0xD0D0D0, // traced from the vectors
+            0x808080, // found by the linear sweep
+            0xF0F055, // jumped or branched to
+            0xA07010, // not code
+        };
+        for(unsigned k=0; k<4; ++k)
+            colors.disasm[k] = glyphs.GetColors(C(disasm_fg[k]), C(0x000000));
+
+        for(auto& c: colors.chr) c = palette.Add(0);
+        SetCHRcolors(0);
+    }
+    // Colors the CHR view with one of the sets. As the CHR colors have palette
+    // entries of their own, this does not need anything to be rendered again.
+    static constexpr unsigned NumCHRcolorSets = 4;
+    void SetCHRcolors(unsigned set)
+    {
+        static const uint32_t sets[NumCHRcolorSets][4] =
+        {
+            { 0x000000, 0xFF556B, 0xFFFFFF, 0x3333FF }, // red, white, blue
+            { 0x000000, 0x3333FF, 0xFFFFFF, 0xFF556B }, // blue, white, red
+            { 0x000000, 0x555555, 0xAAAAAA, 0xFFFFFF }, // grays
+            { 0x9BBC0F, 0x8BAC0F, 0x306230, 0x0F380F }, // greens, light to dark
+        };
+        chr_colors = set % NumCHRcolorSets;
+        for(unsigned c=0; c<4; ++c)
+            palette.Set(colors.chr[c], sets[chr_colors][c]);
+    }
+    void NextCHRcolors()
+    {
+        SetCHRcolors(chr_colors + 1);
+        in_need_of_refreshing.SetRange(0, height);
+        fresh = false;
+    }
+    void BuildHexCells()
+    {
+        // The first two colorschemes alternate every four bytes.
+        hexcells.resize(3 * FontHeight * 256 * HexCellWidth);
+        Pixel* cell = &hexcells[0];
+        for(auto hexcolors: colors.hex)
+            for(unsigned row=0; row<FontHeight; ++row)
+                for(unsigned byte=0; byte<256; ++byte, cell += HexCellWidth)
+                {
+                    glyphs.Put(cell,           hexcolors, (unsigned char) hexbytes[byte >> 4],  row);
+                    glyphs.Put(cell+FontWidth, hexcolors, (unsigned char) hexbytes[byte & 0xF], row);
+                }
+    }
+    // The number of bytes on the line that begins at the offset.
+    unsigned LineWidth(FileOffset offset, const RenderState& rs) const
+    {
+        unsigned w = (!rs.FirstLineLength || offset) ? rs.CharsPerLine : rs.FirstLineLength;
+        if(w > image.size() - offset) w = image.size() - offset;
+        return w;
+    }
+    // The layout of the line that begins at the offset: from the cache, or made into "local".
+    const LineLayout& GetLayout(FileOffset line, FileOffset offset, const RenderState& rs, LineLayout& local) const
+    {
+        unsigned w = LineWidth(offset, rs);
+        if(const LineLayout* l = layouts.Find(line, offset, w, rs.transliterate, rs.transliterate2))
+            return *l;
+        layouts.Build(local, &image[0], offset, w, rs.transliterate, rs.transliterate2);
+        return local;
+    }
+    // Lays out the line of the given row of the dump, so that the
+    // render threads find it in the cache. Not to be called while rendering.
+    void PrepareLayout(FileOffset y, const RenderState& rs)
+    {
+        layouts.Validate(rs.transliterate, rs.transliterate2);
+        FileOffset line = y / FontHeight, offset = rs.GetBeginOffset(line);
+        if(offset < image.size())
+            layouts.Fill(line, &image[0], offset, LineWidth(offset, rs));
+    }
+    // Which bytes of the line are in the search match: those from "begin" up to "end".
+    struct FoundRange
+    {
+        unsigned begin, end;
+        bool Contains(unsigned p) const { return p - begin < end - begin; }
+    };
+    static FoundRange Found(const LineLayout& layout, const RenderState& rs)
+    {
+        FileOffset begin = std::max(rs.HighlightBegin, layout.offset);
+        FileOffset end   = std::min(rs.HighlightEnd,   layout.offset + layout.width);
+        if(begin >= end) return { 0, 0 };
+        return { unsigned(begin - layout.offset), unsigned(end - layout.offset) };
+    }
+
+    void RenderHex(Pixel* scanline, const LineLayout& layout, FoundRange found, unsigned whichline)
+    {
+        const unsigned w = layout.width;
+
+        scanline += LeftWidth;
+
+        std::fill_n(scanline, LeftMargin, colors.black);
+
+        scanline += LeftMargin;
+
+        const Pixel* cells[3] =
+            { &hexcells[(0*FontHeight + whichline) * 256 * HexCellWidth],
+              &hexcells[(1*FontHeight + whichline) * 256 * HexCellWidth],
+              &hexcells[(2*FontHeight + whichline) * 256 * HexCellWidth] };
+
+        for(unsigned p=0; p<w; ++p)
+        {
+            Pixel* target = scanline + HexLayout.x[p];
+            unsigned scheme = found.Contains(p) ? 2 : (p&4) >> 2;
+            std::copy_n(cells[scheme] + layout.bytes[p] * HexCellWidth, HexCellWidth, target);
+            std::fill_n(target + HexCellWidth, HexLayout.gap[p], colors.black);
+        }
+
+        if(w < CharsPerLine)
+            std::fill_n(scanline + HexLayout.x[w], (HexViewWidth-HexLayout.x[w]), colors.gray);
+    }
+    void RenderText(Pixel* scanline, const LineLayout& layout, FoundRange found, unsigned whichline, const RenderState& rs)
+    {
+        const FileOffset ROMoffset = layout.offset;
+        unsigned pre = LeftWidth + LeftMargin + HexViewWidth;
+        scanline += pre;
+
+        std::fill_n(scanline, TextLeftMargin, colors.black);
+
+        unsigned gx = PreviewWidthFor(rs.CharsPerLine);
+
+        pre += TextLeftMargin;
+        scanline += TextLeftMargin;
+
+        CodeIndex::Words words[MaxCharsPerLine / CodeIndex::WordBytes + 1];
+        if(rs.Disassembly && ROMoffset >= rs.FirstLineLength
+        && GetCode(ROMoffset - rs.FirstLineLength, layout.width, words))
+        {
+            RenderCode(scanline, layout, ROMoffset - rs.FirstLineLength, words, whichline);
+            return;
+        }
+
+        const unsigned w = layout.width;
+        for(unsigned p=0, x=0; p<w; x+=FontWidth, ++p)
+            glyphs.Put(scanline+x, found.Contains(p) ? colors.found : colors.text[(p&4) >> 2][layout.cls[p]],
+                       layout.glyph[p], whichline);
+
+        std::fill_n(scanline+w*FontWidth, (rs.CharsPerLine-w)*FontWidth + TextRightMargin, colors.black);
+        pre += rs.CharsPerLine*FontWidth + TextRightMargin;
+        scanline += rs.CharsPerLine*FontWidth + TextRightMargin;
+
+        FileOffset first;
+        unsigned   row;
+        if(ROMoffset >= rs.FirstLineLength)
+        {
+            if(PreviewRow(ROMoffset, whichline, rs, first, row))
+                RenderGFX(scanline, first + (row/8)*16 + row%8, gx, PreviewScale, rs.TallSprites ? 32 : 16);
+            else
+                std::fill_n(scanline, gx, colors.gray);
+
+            pre += gx;
+            scanline += gx;
+        }
+        if(pre < DumpWidth)
+            std::fill_n(scanline, DumpWidth - pre, colors.black);
+    }
+    // Which tiles the preview next to a line shows (see PreviewScale): the first
+    // tile of the line's group, and the tile row at pixel row "whichline" of the
+    // line. Returns false below the last row of the tiles.
+    static bool PreviewRow(FileOffset BeginOffset, unsigned whichline, const RenderState& rs,
+                           FileOffset& first, unsigned& row)
+    {
+        const unsigned   TileSize   = rs.TallSprites ? 32 : 16;
+        const unsigned   GroupLines = TileSize / 8;
+        const FileOffset pos        = BeginOffset - rs.FirstLineLength;
+
+        first = BeginOffset - pos % (GroupLines * rs.CharsPerLine);
+        row   = ((pos / rs.CharsPerLine) % GroupLines * FontHeight + whichline) / PreviewScale;
+        return row < TileSize / 2;
+    }
+    // The words of the code index that cover the "width" bytes at "offset" (from
+    // the first bank), into "out". Returns false if any of them is not indexed yet,
+    // and then the line is drawn as text instead.
+    bool GetCode(FileOffset offset, unsigned width, CodeIndex::Words* out) const
+    {
+        const FileOffset begin = offset - offset % CodeIndex::WordBytes;
+        for(FileOffset o = begin; o < offset + std::max(width, 1u); o += CodeIndex::WordBytes)
+            if(!code->Get(o, *out++))
+                return false;
+        return true;
+    }
+    // Draws a PRG line as code, from the words of the code index that cover it
+    // (see GetCode(); "offset" is where it begins, from the first bank): the
+    // instructions that begin on the line with their operands, across the text
+    // view and the tile previews. Branches, JMP and JSR show the address they go
+    // to, as the bank is currently mapped. A run of bytes that are not code shows
+    // as "db". When not everything fits, the last cell shows a '+'.
+    void RenderCode(Pixel* scanline, const LineLayout& layout, FileOffset offset,
+                    const CodeIndex::Words* words, unsigned whichline)
+    {
+        const unsigned Width = DumpWidth - (LeftWidth + LeftMargin + HexViewWidth + TextLeftMargin);
+        const unsigned Cells = Width / FontWidth;
+
+        bool     data = false; // Whether the previous byte was data
+        unsigned cell = 0;
+        for(unsigned p=0; p<layout.width; ++p)
+        {
+            const unsigned          bit = (offset + p) % CodeIndex::WordBytes;
+            const CodeIndex::Words& w   = words[(offset % CodeIndex::WordBytes + p) / CodeIndex::WordBytes];
+
+            char       name[16];
+            unsigned   n, kind;
+            const bool was_data = data;
+            data = w.data >> bit & 1;
+            if(w.starts >> bit & 1)
+            {
+                // The operand may continue on the next line.
+                unsigned char ins[3] = { layout.bytes[p], 0, 0 };
+                for(unsigned k=1; k<3 && layout.offset + p + k < image.size(); ++k)
+                    ins[k] = image[layout.offset + p + k];
+                const FileOffset at = offset + p;
+                const unsigned   pc = bank_base[at / ROMpageSize] + at % ROMpageSize;
+
+                n = std::sprintf(name, "%s ", Opcodes6502[ins[0]].name);
+                n += FormatOperand6502(name + n, ins, pc);
+                if(name[n-1] == ' ') --n;
+                kind = (w.targets >> bit & 1) ? 2 : (w.traced >> bit & 1) ? 0 : 1;
+            }
+            else if(data && !was_data)
+            {
+                n = std::sprintf(name, "db");
+                kind = 3;
+            }
+            else
+                continue; // Operand bytes, and the rest of a run of data
+
+            if(cell + n >= Cells)
+            {
+                if(cell < Cells)
+                    std::fill_n(scanline + cell*FontWidth, (Cells-1-cell)*FontWidth, colors.black);
+                glyphs.Put(scanline + (Cells-1)*FontWidth, colors.disasm[0], '+', whichline);
+                cell = Cells;
+                break;
+            }
+            for(unsigned c=0; c<n; ++c)
+                glyphs.Put(scanline + (cell+c)*FontWidth, colors.disasm[kind], name[c], whichline);
+            std::fill_n(scanline + (cell+n)*FontWidth, FontWidth, colors.black);
+            cell += n + 1;
+        }
+        std::fill_n(scanline + cell*FontWidth, Width - cell*FontWidth, colors.black);
+    }
+
+    // Where the CHR view actually reads a row of tiles from.
+    static FileOffset GFXrowOffset(FileOffset ROMoffset, bool TallSprites)
+    {
+        if(TallSprites && (ROMoffset & 0x100))
+        {
+            ROMoffset -= 0x100;
+            ROMoffset += 0x10; // TODO: Figure out what is the purpose here
+        }
+        return ROMoffset;
+    }
+    // Draws one pixel row of tiles that are "stride" bytes apart.
+    void RenderGFX(Pixel* scanline, FileOffset ROMoffset, unsigned n_pixels, unsigned scale, unsigned stride)
+    {
+        const unsigned ntiles = (n_pixels + scale*8-1) / (scale*8);
+        const unsigned span   = (ntiles-1) * stride + 16;
+
+        if(ROMoffset + span <= image.size())
+            DecodeTileRows(scanline, &image[ROMoffset], stride, ntiles, scale, colors.chr);
+        else
+        {
+            // Near the end of the image, decode from a zero-padded copy
+            // rather than reading past the end of the mapping.
+            std::vector<unsigned char> tail(span, 0);
+            if(ROMoffset < image.size())
+                std::copy_n(&image[ROMoffset], image.size() - ROMoffset, &tail[0]);
+            DecodeTileRows(scanline, &tail[0], stride, ntiles, scale, colors.chr);
+        }
+    }
+
+    LineSet  dirty_lines;           // Lines that need to be rendered
+    LineSet  in_need_of_refreshing; // Lines whose pixels changed since the last upload
+    bool fresh = false;
+
+    std::string Status, Bottom;
+
+    void MakeDirty()
+    {
+        dirty_lines.SetRange(0, height);
+
+        char Buf[256];
+        std::sprintf(Buf, "ROM size: %u x 16kB ROM, %u x 8kB VROM; 'A' is assumed to be %02X, 'a' to be %02X",
+            header.n_rom16k,
+            header.n_vrom8k,
+            ('A' - transliterate) & 0xFF,
+            ('a' - transliterate - transliterate2) & 0xFF
+        );
+        Status = ShowTimings ? profiler.Summary() : Buf;
+    }
+    // Updates the bottom bar for where the mouse is. It is redrawn only if it changed.
+    void MakeStatusDirty()
+    {
+        std::string old = Bottom;
+        UpdateBottom();
+        if(Bottom != old)
+            dirty_lines.SetRange(height - 16, height);
+    }
+    void UpdateBottom()
+    {
+        if(search.active)
+        {
+            Bottom = SearchPrompt();
+            return;
+        }
+
+        if(mousex >= DumpWidth && mousey >= 16 && mousey < height - 16)
+        {
+            Bottom = MinimapStatus(mousey - 16);
+            return;
+        }
+        if(similar.source != TileIndex::NotFound && mousex == similar.mousex && mousey == similar.mousey)
+        {
+            Bottom = SimilarStatus();
+            return;
+        }
+        FileOffset tile = tiles.Align(TileAt(mousex, mousey));
+        if(tile != TileIndex::NotFound)
+        {
+            Bottom = TileStatus(tile);
+            return;
+        }
+
+        bool clear = false;
+        FileOffset ROMoffset = 0;
+        if(mousey < 16 || mousey >= (height - 16))
+            clear = true;
+        else
+        {
+            FileOffset line = (mousey-16 + ScrollBegin) / FontHeight;
+            ROMoffset = GetBeginOffset(line);
+            int mx = mousex;
+
+            if(mx < int(LeftWidth+LeftMargin))
+                clear = true;
+            else
+            {
+                mx -= LeftWidth+LeftMargin;
+                if(mx < int(HexViewWidth))
+                {
+                    /*
+                        xcoordinate = byteindex * (f*2+1) + (byteindex/4)*2 + (byteindex/16)*2;
+                        solve for xcoordinate gives   8*xcoordinate / (16*f+13)
+                    */
+                    unsigned x = 8*mx / (16*FontWidth + 13);
+                    ROMoffset += x;
+                }
+                else
+                {
+                    mx -= HexViewWidth + TextLeftMargin;
+                    if(mx >= 0 && mx < int(TextViewWidth))
+                        ROMoffset += mx / FontWidth;
+                    else
+                        clear = true;
+                }
+            }
+        }
+        if(clear || ROMoffset >= image.size())
+            Bottom.clear();
+        else
+        {
+            char Addr[64], Buf[256];
+            FormatAddress(Addr, ROMoffset);
+            std::sprintf(Buf, "%s (byte at this location: %02X %02X <%02X> %02X %02X)",
+                Addr,
+                ROMoffset>=2 ? image[ROMoffset-2] : 0xFF,
+                ROMoffset>=1 ? image[ROMoffset-1] : 0xFF,
+                image[ROMoffset  ],
+                (ROMoffset+1) < image.size() ? image[ROMoffset+1] : 0xFF,
+                (ROMoffset+2) < image.size() ? image[ROMoffset+2] : 0xFF
+            );
+            Bottom = Buf;
+        }
+    }
+
+    // Scrolls the dump area between the status bars. The rows that remain
+    // visible are moved within the framebuffer, and only the newly exposed
+    // rows are marked dirty.
+    void ScrollTo(FileOffset newscroll)
+    {
+        if(newscroll == ScrollBegin) return;
+
+        const unsigned   top = 16, viewport = Viewport();
+        const bool       down  = newscroll > ScrollBegin;
+        const FileOffset delta = down ? newscroll - ScrollBegin : ScrollBegin - newscroll;
+        ScrollBegin = newscroll;
+
+        if(delta >= viewport)
+        {
+            // A jump. Let the kernel start reading the pages we are about to show.
+            FileOffset first = GetBeginOffset(ScrollBegin / FontHeight);
+            image.Prefetch(first, (viewport / FontHeight + 2) * CharsPerLine);
+            dirty_lines.SetRange(top, top + viewport);
+        }
+        else
+        {
+            const unsigned keep = viewport - delta;
+            Pixel* area = &framebuffer[top * width];
+            if(down)
+            {
+                std::memmove(area, area + delta*width, keep*width*sizeof(Pixel));
+                for(unsigned y=0; y<keep; ++y)
+                    dirty_lines.Assign(top + y, dirty_lines.Test(top + delta + y));
+                dirty_lines.SetRange(top + keep, top + viewport);
+            }
+            else
+            {
+                std::memmove(area + delta*width, area, keep*width*sizeof(Pixel));
+                for(unsigned y=keep; y-- > 0; )
+                    dirty_lines.Assign(top + delta + y, dirty_lines.Test(top + y));
+                dirty_lines.SetRange(top, top + delta);
+            }
+        }
+
+        // The view marker on the minimap moves along.
+        const RenderState rs = CaptureState();
+        for(unsigned y=0; y<viewport; ++y)
+            RenderMinimap(&framebuffer[(top + y) * width], y, rs);
+
+        // Everything between the status bars has moved on screen.
+        in_need_of_refreshing.SetRange(top, top + viewport);
+        fresh = false;
+    }
+
+    /* Mario walks along the bottom bar.
+     *
+     * The bar is cached in bottom_bar whenever it is rendered, so moving
+     * Mario only restores the pixels under his old position from the cache
+     * and draws him in the new one. Nothing is rendered or checksummed,
+     * and when only Mario moves, only the bottom rows are uploaded.
+     */
+    MarioPos GetMarioPos(unsigned timer) const
+    {
+        const unsigned room_left   = 240;
+        const unsigned room_right  = 8;
+        const unsigned room_wide   = StatusWidth * 8;
+        const unsigned xspanlength = room_wide + room_left + room_right;
+        unsigned long mt = timer / 2;
+        const unsigned MarioStepInterval = 7;
+        const unsigned poses = 2u;
+        unsigned marioframe = (mt / MarioStepInterval) % poses;
+        if(marioframe == 3) marioframe = 1;
+        return { marioframe, timer & 3u, int(mt % xspanlength) - int(room_left) };
+    }
+    // The framebuffer columns that Mario can touch at that position.
+    std::pair<unsigned,unsigned> MarioSpan(const MarioPos& pos) const
+    {
+        int beginx = std::max(pos.x & ~7, 0);
+        int endx   = std::min((pos.x + 16) | 7, int(StatusWidth*8) - 1);
+        if(beginx > endx) return {0,0};
+        return { unsigned(beginx/8)*9, std::min(unsigned(endx/8)*9 + 9, width) };
+    }
+    void DrawMario(Pixel* scanline, unsigned y, const MarioPos& pos) const
+    {
+        const unsigned char* row = mario.bits[pos.pose][pos.phase][pos.x & 3][y] - MarioSprite::MinOffset;
+        const Pixel on = colors.mario_on, body = colors.mario_body;
+        int beginx = pos.x & ~7;
+        int endx   = (pos.x + 16) | 7;
+
+        for(int xp=beginx; xp<=endx; ++xp)
+        {
+            if(xp >= 0 && xp < int(StatusWidth*8))
+            {
+                Pixel* s = scanline + (xp/8)*9 + (xp%8);
+                unsigned char c = row[xp - pos.x];
+                if(c & 2)
+                {
+                    *s = (c & 1) ? on : body;
+                    if((xp & 7) == 7)
+                        s[1] = (c & 1) ? on : body;
+                }
+                else if(*s == colors.black)
+                    *s = on;
+            }
+        }
+    }
+    // Moves Mario to where MarioTimer says. Rows of the bar that are
+    // waiting to be rendered get him when they are rendered.
+    void AnimateMario()
+    {
+        const MarioPos pos = GetMarioPos(MarioTimer);
+        if(pos == mario_drawn) return;
+
+        const unsigned top = height - 16;
+        auto old = MarioSpan(mario_drawn);
+        for(unsigned y=0; y<16; ++y)
+        {
+            if(dirty_lines.Test(top + y)) continue;
+            Pixel* scanline = &framebuffer[(top + y) * width];
+            std::copy(&bottom_bar[y * width + old.first], &bottom_bar[y * width + old.second], scanline + old.first);
+            DrawMario(scanline, y, pos);
+            in_need_of_refreshing.Set(top + y);
+            fresh = false;
+        }
+        mario_drawn = pos;
+    }
+
+    Pixel MinimapColor(BlockClass c) const
+    {
+        return colors.minimap[c];
+    }
+    // The blocks that a row of the minimap stands for. Every row stands for at least one block.
+    std::pair<std::size_t,std::size_t> MinimapBlocks(unsigned row) const
+    {
+        const unsigned    rows  = Viewport();
+        const std::size_t n     = index.NumBlocks();
+        const std::size_t begin = std::min(row * n / rows, n ? n-1 : 0);
+        return { begin, std::min(std::max<std::size_t>((row+1) * n / rows, begin+1), n) };
+    }
+    // Draws the minimap into row "row" of the dump area.
+    void RenderMinimap(Pixel* scanline, unsigned row, const RenderState& rs) const
+    {
+        const unsigned viewport = Viewport();
+        std::size_t b0, b1;
+        std::tie(b0,b1) = MinimapBlocks(row);
+
+        FileOffset first = rs.GetBeginOffset(rs.ScrollBegin / FontHeight);
+        FileOffset last  = rs.GetBeginOffset((rs.ScrollBegin + viewport) / FontHeight + 1);
+        FileOffset bs    = index.BlockSize();
+        bool in_view = b0 < b1 && b0*bs < last && b1*bs > first;
+
+        scanline += DumpWidth;
+        std::fill_n(scanline, MinimapMarker, in_view ? colors.white : colors.black);
+        std::fill_n(scanline + MinimapMarker, MinimapWidth - MinimapMarker, minimap[row]);
+    }
+    std::string MinimapStatus(unsigned row) const
+    {
+        static const char* const names[NumBlockClasses] =
+            { "not indexed yet", "padding", "text", "graphics", "compressed/random", "code/data" };
+        std::size_t b0, b1;
+        std::tie(b0,b1) = MinimapBlocks(row);
+        BlockIndex::Stats st;
+        if(b0 >= b1 || !index.Get(b0, st)) return names[BlockUnknown];
+
+        char Buf[256];
+        std::sprintf(Buf, "%08llX: %s; entropy %.1f fill %u%% text %u%% tiles %u%%",
+            (unsigned long long)(b0 * index.BlockSize()),
+            names[index.Dominant(b0, b1)],
+            st.entropy / 32.0, st.fill * 100u / 255, st.text * 100u / 255, st.tiles * 100u / 255);
+        return Buf;
+    }
+
+    // Keeps the block index going, and redraws the minimap as the index
+    // progresses. Called once per main loop iteration.
+    void UpdateMinimap()
+    {
+        unsigned params = transliterate | (transliterate2 << 8);
+        if(params != minimap_params)
+        {
+            minimap_params = params;
+            index.Restart(transliterate, transliterate2);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        std::size_t done = index.Done();
+        if(done == minimap_done
+        || (done < index.NumBlocks() && now - minimap_time < std::chrono::milliseconds(250)))
+            return;
+        minimap_done = done;
+        minimap_time = now;
+
+        const unsigned top = 16, viewport = Viewport();
+        const RenderState rs = CaptureState();
+        for(unsigned y=0; y<viewport; ++y)
+        {
+            std::size_t b0, b1;
+            std::tie(b0,b1) = MinimapBlocks(y);
+            minimap[y] = MinimapColor(b0 < b1 ? index.Dominant(b0, b1) : BlockUnknown);
+            RenderMinimap(&framebuffer[(top + y) * width], y, rs);
+        }
+        in_need_of_refreshing.SetRange(top, top + viewport);
+        fresh = false;
+    }
+
+    // Keeps the code index going while the disassembly is shown, and redraws
+    // the dump as banks are indexed. Called once per main loop iteration.
+    void UpdateCode()
+    {
+        if(!Disassembly) return;
+        if(code_mapped != bank_base)
+        {
+            code_mapped = bank_base;
+            code->Map(bank_base);
+        }
+        std::size_t published = code->Published();
+        if(published != code_published)
+        {
+            code_published = published;
+            MakeDirty();
+        }
+    }
+    // Whether the dump line that begins at the offset is drawn as code.
+    bool ShowsCode(FileOffset BeginOffset) const
+    {
+        CodeIndex::Words words[MaxCharsPerLine / CodeIndex::WordBytes + 1];
+        return Disassembly && BeginOffset >= FirstLineLength && BeginOffset < image.size()
+            && GetCode(BeginOffset - FirstLineLength, std::min<FileOffset>(CharsPerLine, image.size() - BeginOffset), words);
+    }
+    // Moves the PRG bank under the mouse, or else the one at the top of the view,
+    // between $8000 and $C000. Only that bank is disassembled again.
+    void ToggleBankMapping()
+    {
+        unsigned   y      = mousey >= 16 && mousey < height - 16 ? mousey - 16 : 0;
+        FileOffset offset = GetBeginOffset((y + ScrollBegin) / FontHeight);
+        if(offset < FirstLineLength || offset - FirstLineLength >= bank_base.size() * FileOffset(ROMpageSize))
+            return;
+        unsigned& base = bank_base[(offset - FirstLineLength) / ROMpageSize];
+        base = base == 0x8000 ? 0xC000 : 0x8000;
+
+        // The addresses in the left column change. That is not in the RenderState.
+        ahead.Clear();
+        ahead_complete = ~FileOffset(0);
+        MakeDirty();
+        MakeStatusDirty();
+    }
+
+    // If (x,y) is on the minimap, centers the view on that part of the image.
+    bool MinimapJump(int x, int y, double& aim_pos) const
+    {
+        const int top = 16, viewport = Viewport();
+        if(x < int(DumpWidth) || x >= int(width) || y < top || y >= top + viewport || !index.NumBlocks())
+            return false;
+        FileOffset offset = MinimapBlocks(y - top).first * index.BlockSize();
+        aim_pos = std::max(0.0, GetLineForOffset(offset) * double(FontHeight) - viewport/2);
+        return true;
+    }
+
+    // The tile index, built on the worker threads when first needed
+    // and again whenever the tile size changes.
+    const TileIndex& Tiles()
+    {
+        unsigned unit = TallSprites ? 32 : 16;
+        if(!tiles.Built() || tiles.UnitSize() != unit || tiles.Origin() != FirstLineLength)
+        {
+            tiles.Build(image, FirstLineLength, unit, workers);
+            dup.first = TileIndex::NotFound;
+        }
+        return tiles;
+    }
+
+    // The offset of the tile shown at pixel (x,y), in either the CHR pages
+    // or the tile previews next to the text view, or NotFound.
+    FileOffset TileAt(unsigned x, unsigned y) const
+    {
+        const unsigned gfx_x = LeftWidth + LeftMargin + HexViewWidth;
+        if(y < 16 || y >= height - 16 || x < gfx_x || x >= DumpWidth) return TileIndex::NotFound;
+        x -= gfx_x;
+
+        const FileOffset yoffset     = y - 16 + ScrollBegin;
+        const FileOffset BeginOffset = GetBeginOffset(yoffset / FontHeight);
+        const FileOffset NonVROMsize = FirstLineLength + header.n_rom16k * ROMpageSize;
+        const unsigned   stride      = TallSprites ? 32 : 16;
+        if(BeginOffset >= image.size()) return TileIndex::NotFound;
+
+        FileOffset row;
+        unsigned   scale;
+        if(BeginOffset < NonVROMsize)
+        {
+            // The same choice of tiles as in RenderText().
+            const unsigned pre = TextLeftMargin + TextViewWidth + TextRightMargin;
+            if(BeginOffset < FirstLineLength || x < pre || x >= pre + PreviewWidthFor(CharsPerLine)
+            || ShowsCode(BeginOffset))
+                return TileIndex::NotFound;
+
+            FileOffset first;
+            unsigned   r;
+            if(!PreviewRow(BeginOffset, yoffset % FontHeight, CaptureState(), first, r))
+                return TileIndex::NotFound;
+            row   = first + (r/8)*16 + r%8;
+            scale = PreviewScale;
+            x -= pre;
+        }
+        else
+        {
+            // The same layout as in RenderDumpLine().
+            FileOffset NonVROMlines       = NumHeaderLines + (NonVROMsize - FirstLineLength) / CharsPerLine;
+            FileOffset GFXpageBeginOffset = (BeginOffset - NonVROMsize) & ~FileOffset(0xFFF);
+            FileOffset ypixel_relative    = yoffset - FontHeight * (NonVROMlines + GFXpageBeginOffset / CharsPerLine);
+            if(ypixel_relative >= GFXviewHeight || x >= GFXviewWidth) return TileIndex::NotFound;
+            unsigned ypixel_unscale = ypixel_relative / GFXviewScale;
+            row   = GFXrowOffset(NonVROMsize + GFXpageBeginOffset + (ypixel_unscale/8)*16*16 + (ypixel_unscale%8),
+                                 TallSprites);
+            scale = GFXviewScale;
+        }
+        FileOffset tile = row + (x / (8*scale)) * stride;
+        tile -= (tile - FirstLineLength) % 16;
+        return tile + 16 <= image.size() ? tile : TileIndex::NotFound;
+    }
+
+    std::string TileStatus(FileOffset tile) const
+    {
+        FileOffset first;
+        std::size_t count;
+        std::tie(first,count) = tiles.Occurrences(tile);
+
+        char Addr[64], Buf[256];
+        FormatAddress(Addr, tile);
+        // The key hint comes first, so that the bottom bar never cuts it off.
+        if(count <= 1)
+            std::snprintf(Buf, sizeof Buf, "%s: tile occurs nowhere else", Addr);
+        else if(first == dup.first && dup.at != TileIndex::NotFound)
+        {
+            char At[64];
+            FormatAddress(At, dup.at);
+            std::snprintf(Buf, sizeof Buf, "'d'/'D': %s occurs %zu times, now at %s",
+                Addr, count, At);
+        }
+        else
+            std::snprintf(Buf, sizeof Buf, "'d'/'D': %s occurs %zu times, first at %08llX",
+                Addr, count, (unsigned long long)first);
+        return Buf;
+    }
+
+    // Steps to the next or previous occurrence of the tile under the mouse,
+    // and highlights it. Stepping continues with the same tile for as long
+    // as the mouse stays where it was.
+    void StepTile(bool forward, double& aim_pos)
+    {
+        const TileIndex& index = Tiles();
+        FileOffset tile = index.Align(TileAt(mousex, mousey));
+        bool moved = mousex != dup.mousex || mousey != dup.mousey;
+        if(tile != TileIndex::NotFound && (moved || dup.first == TileIndex::NotFound))
+        {
+            dup.first = index.Occurrences(tile).first;
+            dup.at    = tile;
+        }
+        if(dup.first == TileIndex::NotFound) return;
+        dup.mousex = mousex;
+        dup.mousey = mousey;
+        similar.source = TileIndex::NotFound;
+
+        FileOffset at = forward ? index.Next(dup.at) : index.Prev(dup.at);
+        if(at == TileIndex::NotFound)
+        {
+            // Wrap around
+            at = dup.first;
+            if(!forward)
+                for(FileOffset o = at; o != TileIndex::NotFound; o = index.Next(o))
+                    at = o;
+        }
+        dup.at            = at;
+        search.hit        = at;
+        search.hit_length = index.UnitSize();
+        Reveal(at, aim_pos);
+        MakeDirty();
+        MakeStatusDirty();
+    }
+
+    // Finds the n tiles that look most like the one at "tile", anywhere
+    // in the image, on the worker threads.
+    std::vector<SimilarTiles::Match> FindSimilarTiles(FileOffset tile, std::size_t n)
+    {
+        const SimilarTiles finder(&image[tile]);
+        const FileOffset   origin = FirstLineLength;
+        const std::size_t  units  = image.size() > origin ? (image.size() - origin) / 16 : 0;
+        const std::size_t  block  = std::max<std::size_t>(16384, units / (workers.Size() * 4) + 1);
+
+        std::vector<std::vector<SimilarTiles::Match>> found((units + block - 1) / block);
+        workers.Run(found.size(), [&](unsigned b)
+        {
+            found[b] = finder.Find(&image[0], origin + b*block*16, std::min(block, units - b*block), n, tile);
+        });
+
+        std::vector<SimilarTiles::Match> result;
+        for(const auto& f: found) result.insert(result.end(), f.begin(), f.end());
+        std::sort(result.begin(), result.end());
+        if(result.size() > n) result.resize(n);
+        return result;
+    }
+
+    // Steps to the next or previous tile that looks like the one under the mouse,
+    // best match first. The search is done when the mouse has moved since the last step.
+    void StepSimilar(bool forward, double& aim_pos)
+    {
+        FileOffset tile = TileAt(mousex, mousey);
+        bool moved = mousex != similar.mousex || mousey != similar.mousey;
+        if(tile != TileIndex::NotFound && (moved || similar.source == TileIndex::NotFound))
+        {
+            similar.source  = tile;
+            similar.matches = FindSimilarTiles(tile, 64);
+            similar.at      = forward ? 0 : similar.matches.size() - 1;
+        }
+        else if(similar.source == TileIndex::NotFound)
+            return;
+        else if(!similar.matches.empty())
+            similar.at = (similar.at + (forward ? 1 : similar.matches.size() - 1)) % similar.matches.size();
+        similar.mousex = mousex;
+        similar.mousey = mousey;
+        dup.first = TileIndex::NotFound;
+
+        if(!similar.matches.empty())
+        {
+            search.hit        = similar.matches[similar.at].offset;
+            search.hit_length = 16;
+            Reveal(search.hit, aim_pos);
+            MakeDirty();
+        }
+        MakeStatusDirty();
+    }
+
+    std::string SimilarStatus() const
+    {
+        char Src[64], Buf[256];
+        FormatAddress(Src, similar.source);
+        if(similar.matches.empty())
+        {
+            std::snprintf(Buf, sizeof Buf, "%s: no other tiles", Src);
+            return Buf;
+        }
+        // Kept short enough for the bottom bar: d = pixels that differ, c = the colors.
+        static const char* const flips[4] = { "", " mirrored", " upside down", " rotated" };
+        const SimilarTiles::Match& m = similar.matches[similar.at];
+        char At[64];
+        FormatAddress(At, m.offset);
+        std::snprintf(Buf, sizeof Buf, "Like %.8s: %u/%u @%s d=%u%s c=%u%u%u%u; f/F next",
+            Src, unsigned(similar.at + 1), unsigned(similar.matches.size()), At, m.distance,
+            flips[m.flip], m.colors[0], m.colors[1], m.colors[2], m.colors[3]);
+        return Buf;
+    }
+
+    void ToggleTimings()
+    {
+        ShowTimings      = !ShowTimings;
+        profiler.enabled = ShowTimings || profiler.Tracing();
+        MakeDirty();
+    }
+    // Called once per main loop iteration.
+    void EndFrame()
+    {
+        if(profiler.EndFrame() && ShowTimings)
+        {
+            Status = profiler.Summary();
+            dirty_lines.SetRange(0, 16);
+        }
+    }
+
+    void Refresh_Update()
+    {
+        if(fresh) return;
+
+        if(!texture)
+        {
+            // No window (e.g. when benchmarking); there is nothing to upload.
+            in_need_of_refreshing.Clear();
+            fresh = true;
+        }
+        else
+        {
+            // Upload only the changed rows. Spans separated by a gap of
+            // one or two unchanged rows are merged into one update.
+            auto t0 = profiler.Now();
+            unsigned span_begin = 0, span_end = 0;
+            auto Upload = [&]()
+            {
+                // The rows are converted into colors straight into the texture.
+                SDL_Rect r { 0, int(span_begin), int(width), int(span_end - span_begin) };
+                void* pixels; int pitch;
+                if(SDL_LockTexture(texture, &r, &pixels, &pitch) != 0) return;
+                for(unsigned y=span_begin; y<span_end; ++y)
+                    palette.Expand((uint32_t*)((char*)pixels + (y - span_begin) * pitch), &framebuffer[y * width], width);
+                SDL_UnlockTexture(texture);
+                profiler.Count(FrameProfiler::BytesUploaded, (span_end - span_begin) * width * sizeof(uint32_t));
+            };
+            in_need_of_refreshing.ForEachSpan([&](unsigned begin, unsigned end)
+            {
+                if(span_end != span_begin && begin <= span_end + 2)
+                    { span_end = end; return; }
+                if(span_end != span_begin) Upload();
+                span_begin = begin;
+                span_end   = end;
+            });
+            if(span_end != span_begin) Upload();
+            profiler.Span(FrameProfiler::Upload, t0);
+
+            auto t1 = profiler.Now();
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+            SDL_RenderPresent(renderer);
+            profiler.Span(FrameProfiler::Present, t1);
+
+            in_need_of_refreshing.Clear();
+            fresh = true;
+        }
+    }
+
+    static crc32_t CheckSum(const void* p, std::size_t n)
+    {
+        return crc32_calc( (const unsigned char*) p, n );
+    }
+
+    // Renders line y. Returns true if its pixels changed.
+    bool RenderAndCompare(unsigned y, const RenderState& rs)
+    {
+        auto t0 = profiler.Now();
+        auto checksum_before = CheckSum( &framebuffer[0] + y * width, width*sizeof(Pixel) );
+        auto t1 = profiler.Now();
+        RenderLine(y, rs);
+        auto t2 = profiler.Now();
+        auto checksum_after  = CheckSum( &framebuffer[0] + y * width, width*sizeof(Pixel) );
+        auto t3 = profiler.Now();
+
+        profiler.Add(FrameProfiler::Checksum, t0, t1);
+        profiler.Add(FrameProfiler::Render,   t1, t2);
+        profiler.Add(FrameProfiler::Checksum, t2, t3);
+        return checksum_before != checksum_after;
+    }
+
+    // Renders dirty lines until none remain or the time budget runs out,
+    // then presents what has changed. The lines are rendered in batches
+    // that are spread across the worker threads; each thread only writes
+    // into the framebuffer rows it was given and into its slot in "changed".
+    void RefreshFrame(std::chrono::microseconds budget)
+    {
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        const RenderState rs = CaptureState();
+        const unsigned batch = workers.Size() * 16;
+
+        FillFromCache(rs);
+
+        std::vector<unsigned> rows;
+        std::vector<unsigned char> changed;
+        while(!IsClean())
+        {
+            rows.clear();
+            for(unsigned y = dirty_lines.FindNext(0); y < height && rows.size() < batch; y = dirty_lines.FindNext(y+1))
+            {
+                rows.push_back(y);
+                dirty_lines.Reset(y);
+            }
+            changed.assign(rows.size(), false);
+            for(unsigned y: rows)
+                if(y >= 16 && y < height - 16)
+                    PrepareLayout(y - 16 + rs.ScrollBegin, rs);
+
+            auto t0 = profiler.Now();
+            workers.Run(rows.size(), [&](unsigned n) { changed[n] = RenderAndCompare(rows[n], rs); });
+            profiler.Span("render batch", t0);
+
+            unsigned n_changed = 0;
+            for(unsigned n=0; n<rows.size(); ++n)
+                if(changed[n])
+                {
+                    in_need_of_refreshing.Set(rows[n]);
+                    ++n_changed;
+                }
+            profiler.Count(FrameProfiler::LinesRendered,  rows.size());
+            profiler.Count(FrameProfiler::LinesUnchanged, rows.size() - n_changed);
+            fresh = false;
+
+            if(std::chrono::steady_clock::now() >= deadline) break;
+        }
+        Refresh_Update();
+    }
+
+    /* Render-ahead.
+     *
+     * When there is nothing else to do, the rows that the jump keys would
+     * bring into view are rendered in advance into the "ahead" cache,
+     * nearest first. When a jump exposes them, they are copied from
+     * the cache instead of being rendered.
+     */
+    // Where the view would be after the jump, from where it is aimed now.
+    double JumpTarget(Jump jump, double aim_pos) const
+    {
+        const unsigned viewport = Viewport();
+        long offs_now  = GetBeginOffset(aim_pos / FontHeight + 0.5);
+        if(offs_now >= long(FirstLineLength)) offs_now -= FirstLineLength;
+        long gfx_begin = header.n_rom16k * ROMpageSize;
+        double aim;
+        switch(jump)
+        {
+            case JumpPageUp:
+                if(offs_now > gfx_begin)
+                    aim = ((offs_now & 0xFFF) ? offs_now &~ 0xFFF : (offs_now-0x1000));
+                else
+                    aim = ((offs_now & 0x3FF) ? offs_now &~ 0x3FF : (offs_now - 0x400));
+                break;
+            case JumpPageDown:
+                if(offs_now >= gfx_begin)
+                    aim = (offs_now + 0x1000) & ~0xFFF;
+                else
+                    aim = (offs_now + 0x400) & ~0x3FF;
+                break;
+            case JumpBankUp:
+                if(offs_now > gfx_begin)
+                    aim = ((offs_now & 0xFFF) ? offs_now &~ 0xFFF : (offs_now-0x1000));
+                else
+                    aim = ((offs_now & 0x3FFF) ? offs_now &~ 0x3FFF : (offs_now - 0x4000));
+                break;
+            case JumpBankDown:
+                if(offs_now >= gfx_begin)
+                    aim = (offs_now + 0x1000) & ~0xFFF;
+                else
+                    aim = (offs_now + 0x4000) & ~0x3FF;
+                break;
+            case JumpHome:
+            {
+                long offs = GetBeginOffset(aim_pos / FontHeight + 0.5);
+                long rom_begin = FirstLineLength, vrom_begin = FirstLineLength + gfx_begin;
+                if(offs > vrom_begin)     return FontHeight * (1 + (vrom_begin-FirstLineLength) / double(CharsPerLine));
+                else if(offs > rom_begin) return FontHeight * (1 + (rom_begin-FirstLineLength) / double(CharsPerLine));
+                return 0;
+            }
+            case JumpEnd: default:
+            {
+                auto pagebeginpos = [=](double p) -> double
+                {
+                    double r = (1 + (p-FirstLineLength) / (double)CharsPerLine) * FontHeight - viewport;
+                    if(r < 0) r = 0;
+                    return r;
+                };
+                long offs = GetBeginOffset((aim_pos + viewport) / FontHeight + 1);
+                long vrom_begin = FirstLineLength + gfx_begin;
+                return long(offs < vrom_begin ? pagebeginpos(vrom_begin) : pagebeginpos(image.size()));
+            }
+        }
+        aim *= double(FontHeight) / double(CharsPerLine);
+        aim += NumHeaderLines*FontHeight;
+        return aim < 0 ? 0 : aim;
+    }
+
+    // Everything besides the position that the rendered dump rows depend on.
+    static RowCache::Settings AheadSettings(const RenderState& rs)
+    {
+        return { rs.transliterate, rs.transliterate2, rs.TallSprites,
+                 rs.FirstLineLength, rs.NumHeaderLines, rs.CharsPerLine, rs.HighlightBegin, rs.HighlightEnd,
+                 rs.Disassembly, rs.CodeVersion };
+    }
+
+    void ValidateAhead(const RenderState& rs)
+    {
+        if(ahead.Validate(AheadSettings(rs)))
+            ahead_complete = ~FileOffset(0);
+    }
+
+    // Copies those dirty rows of the dump that have been rendered ahead.
+    void FillFromCache(const RenderState& rs)
+    {
+        const unsigned top = 16, viewport = Viewport();
+        ValidateAhead(rs);
+        for(unsigned y = dirty_lines.FindNext(top); y < top + viewport; y = dirty_lines.FindNext(y+1))
+            if(const Pixel* row = ahead.Find(rs.ScrollBegin + y - top))
+            {
+                Pixel* scanline = &framebuffer[y * width];
+                std::copy_n(row, DumpWidth, scanline);
+                RenderMinimap(scanline, y - top, rs);
+                dirty_lines.Reset(y);
+                in_need_of_refreshing.Set(y);
+                fresh = false;
+            }
+    }
+
+    // Renders rows ahead until the time budget runs out.
+    // Returns false when there is nothing left to render ahead.
+    bool RenderAhead(std::chrono::microseconds budget)
+    {
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        const RenderState rs = CaptureState();
+        const unsigned viewport = Viewport();
+        const FileOffset end = (GetLineForOffset(image.size()) + 1) * FontHeight;
+        ValidateAhead(rs);
+        if(ahead_complete == rs.ScrollBegin) return false;
+
+        // Nearest first: a page, then a bank, then the ends of PRG or CHR.
+        // The view itself is not needed.
+        static const Jump order[NumJumps] = { JumpPageDown, JumpPageUp, JumpBankDown, JumpBankUp, JumpEnd, JumpHome };
+        std::vector<FileOffset> want, targets { rs.ScrollBegin };
+        for(Jump j: order)
+        {
+            FileOffset target = JumpTarget(j, rs.ScrollBegin);
+            // Rows that are already cached are touched, so that the new ones do not push them out.
+            for(FileOffset y = target; y < target + viewport && y < end; ++y)
+                if(std::none_of(targets.begin(), targets.end(), [=](FileOffset t) { return y >= t && y < t + viewport; })
+                && !ahead.Find(y))
+                    want.push_back(y);
+            targets.push_back(target);
+        }
+
+        const unsigned batch = workers.Size() * 16;
+        std::vector<Pixel*> buffers;
+        for(std::size_t done = 0; done < want.size(); done += batch)
+        {
+            if(std::chrono::steady_clock::now() >= deadline) return true;
+            std::size_t n = std::min<std::size_t>(batch, want.size() - done);
+            buffers.clear();
+            for(std::size_t i=0; i<n; ++i)
+            {
+                buffers.push_back(ahead.Insert(want[done + i]));
+                PrepareLayout(want[done + i], rs);
+            }
+            workers.Run(n, [&](unsigned i) { RenderDumpLine(buffers[i], want[done + i], rs); });
+        }
+        ahead_complete = rs.ScrollBegin;
+        return false;
+    }
+
+    // Renders "count" lines of the dump, starting from "first_line",
+    // into an image file. No window is needed. The lines are rendered
+    // a block at a time and written out as soon as they are done.
+    bool RenderToFile(const std::string& filename, FileOffset first_line, FileOffset count)
+    {
+        const RenderState rs = CaptureState();
+        const unsigned BlockLines = 64;
+
+        // Checked here too, as count * FontHeight could wrap around.
+        if(count > ImageFileWriter::MaxHeight / FontHeight)
+        {
+            errno = EFBIG;
+            return false;
+        }
+        ImageFileWriter out;
+        if(!out.Open(filename, DumpWidth, count * FontHeight))
+            return false;
+
+        std::vector<Pixel>    block(DumpWidth * FontHeight * BlockLines);
+        std::vector<uint32_t> row(DumpWidth);
+        for(FileOffset line = first_line; line < first_line + count; line += BlockLines)
+        {
+            unsigned rows = std::min<FileOffset>(BlockLines, first_line + count - line) * FontHeight;
+            for(unsigned y=0; y<rows; y += FontHeight)
+                PrepareLayout(line * FontHeight + y, rs);
+            workers.Run(rows, [&](unsigned y)
+            {
+                RenderDumpLine(&block[y * DumpWidth], line * FontHeight + y, rs);
+            });
+            for(unsigned y=0; y<rows; ++y)
+            {
+                palette.Expand(&row[0], &block[y * DumpWidth], DumpWidth);
+                out.WriteRow(&row[0]);
+            }
+        }
+        return out.Close();
+    }
+
+    /* Search.
+     *
+     * The prompt is shown in the bottom bar. Typing searches incrementally
+     * from where the view was when the prompt was opened. Tab switches between
+     * hex bytes (with '?' for wildcard nibbles), text (found as it would be
+     * shown, i.e. with the current transliteration), and relative search, which
+     * finds a word in any encoding and sets the transliteration to match.
+     * F2 limits the search to PRG or CHR. Enter keeps the match; Esc returns
+     * to where the view was. Afterwards, 'n' and 'N' step to the next and
+     * previous match.
+     *
+     * Those functions that can scroll take the scroll target of the main loop.
+     */
+    void BeginSearchDialog(double aim_pos)
+    {
+        search.active     = true;
+        search.query.clear();
+        search.valid      = false;
+        search.origin_aim = aim_pos;
+        search.origin     = GetBeginOffset(FileOffset(aim_pos) / FontHeight);
+        search.origin_transliterate  = transliterate;
+        search.origin_transliterate2 = transliterate2;
+        MakeStatusDirty();
+    }
+
+    // Returns false for the events that the prompt does not use.
+    bool SearchEvent(const SDL_Event& event, double& aim_pos)
+    {
+        if(event.type == SDL_TEXTINPUT)
+        {
+            if(search.query.size() < 64)
+                search.query += event.text.text;
+        }
+        else if(event.type == SDL_KEYDOWN)
+            switch(event.key.keysym.sym)
+            {
+                case SDLK_BACKSPACE:
+                    if(!search.query.empty()) search.query.pop_back();
+                    break;
+                case SDLK_TAB:
+                    search.mode  = SearchMode((search.mode + 1) % 3);
+                    break;
+                case SDLK_F2:
+                    search.scope = SearchScope((search.scope + 1) % 3);
+                    break;
+                case SDLK_RETURN:
+                    search.active = false;
+                    MakeStatusDirty();
+                    return true;
+                case SDLK_ESCAPE:
+                    search.active  = false;
+                    search.hit     = PatternSearcher::NotFound;
+                    aim_pos        = search.origin_aim;
+                    transliterate  = search.origin_transliterate;
+                    transliterate2 = search.origin_transliterate2;
+                    MakeDirty();
+                    MakeStatusDirty();
+                    return true;
+                default:
+                    return true;
+            }
+        else
+            return false;
+
+        // Search again from the beginning, as the pattern has changed.
+        if(search.mode == SearchRelative)
+        {
+            transliterate  = search.origin_transliterate;
+            transliterate2 = search.origin_transliterate2;
+        }
+        Search(search.origin, true, aim_pos);
+        return true;
+    }
+
+    // Steps to the next or previous match of the last search.
+    void FindNext(bool forward, double& aim_pos)
+    {
+        if(search.hit == PatternSearcher::NotFound)
+            Search(search.origin, forward, aim_pos);
+        else
+            Search(forward ? search.hit + 1 : search.hit, forward, aim_pos);
+    }
+
+    std::string SearchPrompt() const
+    {
+        static const char* const modes[3]  = { "hex", "text", "relative" };
+        static const char* const scopes[3] = { "all", "PRG", "CHR" };
+        std::string result;
+        if(!search.valid)
+            result = search.query.empty() ? "(Tab: hex/text/relative, F2: all/PRG/CHR)"
+                   : search.mode == SearchRelative ? "(needs 3 letters of one case)" : "(invalid)";
+        else if(search.hit == PatternSearcher::NotFound)
+            result = "(not found)";
+        else
+        {
+            char Addr[64];
+            FormatAddress(Addr, search.hit);
+            result = std::string("at ") + Addr;
+        }
+        return std::string("Find ") + modes[search.mode] + " in " + scopes[search.scope]
+             + ": " + search.query + "_ " + result;
+    }
+
+private:
+    // Runs searcher.FindFirst() or FindLast() over data[begin..end) in blocks
+    // that are spread across the worker threads, and returns the first or last
+    // match of all. A match may continue past its block, but not past "end".
+    template<typename Searcher>
+    FileOffset FindParallel(const Searcher& searcher, FileOffset begin, FileOffset end, bool first)
+    {
+        const FileOffset m = searcher.size();
+        if(m == 0 || end < begin || end - begin < m) return PatternSearcher::NotFound;
+
+        const FileOffset starts = end - begin - m + 1;
+        const FileOffset block  = std::max<FileOffset>(262144, starts / (workers.Size() * 4) + 1);
+        std::vector<FileOffset> found((starts + block - 1) / block);
+
+        const unsigned char* data = &image[0];
+        workers.Run(found.size(), [&](unsigned n)
+        {
+            FileOffset b = begin + n * block, e = std::min(b + block + m-1, end);
+            found[n] = first ? searcher.FindFirst(data, b, e) : searcher.FindLast(data, b, e);
+        });
+
+        if(first)
+        {
+            for(FileOffset f: found) if(f != PatternSearcher::NotFound) return f;
+        }
+        else
+        {
+            for(std::size_t n = found.size(); n-- > 0; ) if(found[n] != PatternSearcher::NotFound) return found[n];
+        }
+        return PatternSearcher::NotFound;
+    }
+
+    // Finds a match starting at or after "from" (forward), or before "from"
+    // (backward), wrapping around at the ends of the searched range.
+    template<typename Searcher>
+    FileOffset FindWrapped(const Searcher& searcher, FileOffset from, bool forward, FileOffset begin, FileOffset end)
+    {
+        const FileOffset m = searcher.size();
+        FileOffset hit;
+        if(forward)
+        {
+            hit = FindParallel(searcher, from, end, true);
+            if(hit == PatternSearcher::NotFound)
+                hit = FindParallel(searcher, begin, std::min(from + m-1, end), true);
+        }
+        else
+        {
+            hit = FindParallel(searcher, begin, std::min(from + m-1, end), false);
+            if(hit == PatternSearcher::NotFound)
+                hit = FindParallel(searcher, from, end, false);
+        }
+        return hit;
+    }
+
+    // Scrolls the offset into view, unless it is already in view.
+    void Reveal(FileOffset offset, double& aim_pos) const
+    {
+        const unsigned viewport = Viewport();
+        double y = GetLineForOffset(offset) * double(FontHeight);
+        if(y < aim_pos || y + FontHeight > aim_pos + viewport)
+            aim_pos = std::max(0.0, y - viewport/3);
+    }
+
+    void Search(FileOffset from, bool forward, double& aim_pos)
+    {
+        FileOffset prg_begin = FirstLineLength, chr_begin = prg_begin + header.n_rom16k * ROMpageSize;
+        FileOffset begin = 0, end = image.size();
+        if(search.scope == SearchPRG) { begin = prg_begin; end = chr_begin; }
+        if(search.scope == SearchCHR) { begin = chr_begin; end = chr_begin + header.n_vrom8k * VROMpageSize; }
+        if(end > image.size()) end = image.size();
+        if(begin > end) begin = end;
+        if(from < begin) from = begin;
+        if(from > end)   from = end;
+
+        search.hit = PatternSearcher::NotFound;
+        image.AdviseSequential(begin, end - begin);
+        if(search.mode == SearchRelative)
+        {
+            RelativeSearcher searcher(search.query, transliterate2);
+            search.valid = searcher.Valid();
+            if(search.valid)
+            {
+                search.hit        = FindWrapped(searcher, from, forward, begin, end);
+                search.hit_length = searcher.size();
+                if(search.hit != PatternSearcher::NotFound)
+                    searcher.Solve(&image[search.hit], transliterate, transliterate2);
+            }
+        }
+        else
+        {
+            SearchPattern pat;
+            if(search.mode == SearchText)
+            {
+                pat = MakeTextPattern(search.query, transliterate, transliterate2);
+                search.valid = !search.query.empty();
+            }
+            else
+                search.valid = ParseHexPattern(search.query, pat);
+
+            if(search.valid)
+            {
+                PatternSearcher searcher(std::move(pat));
+                search.hit        = FindWrapped(searcher, from, forward, begin, end);
+                search.hit_length = searcher.size();
+            }
+        }
+        image.AdviseRandom(begin, end - begin);
+
+        if(search.hit != PatternSearcher::NotFound)
+            Reveal(search.hit, aim_pos);
+        MakeDirty();
+        MakeStatusDirty();
+    }
+
+public:
+
+    bool IsClean() const
+    {
+        return dirty_lines.Empty();
+    }
+};
@@ -0,0 +1,88 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/* A persistent pool of worker threads.
+ *
+ * Run(count, job) calls job(0) .. job(count-1), spread across the workers
+ * and the calling thread, and returns once all of them have finished.
+ * Items are handed out one at a time from a shared counter, so uneven
+ * items (e.g. text lines versus blank lines) balance out by themselves.
+ */
+class WorkerPool
+{
+    std::vector<std::thread>  threads;
+    std::mutex                lock;
+    std::condition_variable   wake, done;
+    const std::function<void(unsigned)>* job = nullptr;
+    std::atomic<unsigned>     next{0};
+    unsigned                  count = 0, busy = 0, generation = 0;
+    bool                      quit = false;
+
+    void Work()
+    {
+        for(unsigned n; (n = next.fetch_add(1)) < count; )
+            (*job)(n);
+    }
+    void Thread()
+    {
+        unsigned seen = 0;
+        std::unique_lock<std::mutex> l(lock);
+        for(;;)
+        {
+            wake.wait(l, [&]{ return quit || generation != seen; });
+            if(quit) return;
+            seen = generation;
+
+            l.unlock();
+            Work();
+            l.lock();
+
+            if(--busy == 0) done.notify_one();
+        }
+    }
+
+public:
+    explicit WorkerPool(unsigned nthreads = std::thread::hardware_concurrency())
+    {
+        for(unsigned n=1; n<nthreads; ++n)
+            threads.emplace_back(&WorkerPool::Thread, this);
+    }
+    ~WorkerPool()
+    {
+        { std::lock_guard<std::mutex> l(lock);
+          quit = true; }
+        wake.notify_all();
+        for(auto& t: threads) t.join();
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    void operator=(const WorkerPool&) = delete;
+
+    // Number of threads that participate in Run(), including the caller.
+    unsigned Size() const { return threads.size() + 1; }
+
+    void Run(unsigned n, const std::function<void(unsigned)>& f)
+    {
+        if(threads.empty() || n < 2)
+        {
+            for(unsigned i=0; i<n; ++i) f(i);
+            return;
+        }
+        { std::lock_guard<std::mutex> l(lock);
+          job   = &f;
+          count = n;
+          next  = 0;
+          busy  = threads.size();
+          ++generation; }
+        wake.notify_all();
+
+        Work();
+
+        std::unique_lock<std::mutex> l(lock);
+        done.wait(l, [&]{ return busy == 0; });
+        job = nullptr;
+    }
+};